@@ -0,0 +1,339 @@
+/*
+ * fm_dsp, the float FM demodulator of rtl_fm_player: downsample, FM
+ * discriminator, stereo decoder, resampler, de-emphasis and S16 output
+ * Based on rtl_fm_streamer by Albrecht Lohoefener
+ * Based on "rtl_fm", see http://sdr.osmocom.org/trac/wiki/rtl-sdr for details
+ *
+ * Copyright (C) 2012 by Steve Markgraf <steve@steve-m.de>
+ * Copyright (C) 2012 by Hoernchen <la@tfc-server.de>
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ * Copyright (C) 2013 by Elias Oenal <EliasOenal@gmail.com>
+ * Copyright (C) 2015 by Miroslav Slugen <thunder.m@email.cz>
+ * Copyright (C) 2015 by Albrecht Lohoefener <albrechtloh@gmx.de>
+ * Copyright (C) 2024 by Rafael Ferrari <rafaelbf@hotmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FM_DSP_H
+#define FM_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define DEFAULT_BUF_LENGTH		(1 * 16384)
+#define MAXIMUM_OVERSAMPLE		16
+#define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
+
+/* every buffer of the DSP starts on a cache line */
+#define DSP_ALIGN				64
+
+#define PI2_F           6.28318531f
+#define PI_F            3.14159265f
+#define PI_2_F          1.5707963f
+#define PI_4_F          0.78539816f
+
+#define DEEMPHASIS_NONE         0
+#define DEEMPHASIS_FM_EU        0.000050
+#define DEEMPHASIS_FM_USA       0.000075
+
+/* demod_state.custom_atan */
+#define ATAN_STD                0
+#define ATAN_FAST               1
+#define ATAN_LUT                2
+
+/* FIR decimator for interleaved IQ, the history and the new input
+ share one contiguous delay line */
+struct decimator_f32
+{
+	int factor;
+	int taps;
+	int coef_len; /* floats, 2 * taps padded to a multiple of 16 */
+	float *coef; /* reversed, every tap twice for I and Q */
+	float *line;
+	int line_len; /* floats used */
+	int pos; /* start of the next window */
+	int line_size;
+};
+
+/* frequency shift of the full rate input, tab holds e^-jwk for one tile
+ plus e^-jwN to step the phase from one tile to the next */
+#define MIXER_TILE 1024
+
+struct mixer_f32
+{
+	float tab[2 * (MIXER_TILE + 1)];
+	float ph_r; /* phase at the start of the next tile */
+	float ph_j;
+};
+
+/* polyphase filter bank: nch channels rate / nch apart, every one
+ decimated by factor. the prototype is the decimator low pass with taps
+ per branch, nch has to be a power of two for the FFT */
+#define PFB_MAX_CHANNELS 32
+#define PFB_LANES 8
+
+struct pfb_f32
+{
+	int nch; /* M */
+	int factor; /* D, less or equal to M */
+	int taps; /* per branch */
+	float *coef; /* reversed, every tap twice for I and Q */
+	float *line; /* input, like the decimator */
+	int line_len;
+	int pos;
+	int line_size;
+	int phase; /* (input index of the window) % M */
+	float tw[2 * PFB_MAX_CHANNELS]; /* e^j2pi i / M */
+	int rev[PFB_MAX_CHANNELS]; /* bit reversed index */
+};
+
+/* IQ samples per tile of the fused demodulator, audio room for up to
+ 4x upsampling in stereo */
+#define DEMOD_TILE 512
+#define DEMOD_TILE_AUDIO (8 * DEMOD_TILE)
+
+/* samples per pass of the stereo decoder and per tile of its filters */
+#define LP_REAL_BLOCK 4096
+#define LP_REAL_TILE 256
+
+/* limit of L in the L/M resampler, bounds the size of the phase banks */
+#define RESAMPLER_MAX_PHASES 1024
+
+/* polyphase rational resampler, output m is made from phase (m * M) % L
+ ending at input (m * M) / L, phases are stored in delay line order */
+struct resampler_f32
+{
+	int up; /* L */
+	int down; /* M */
+	int taps; /* per phase */
+	int channels; /* interleaved in the delay line */
+	int coef_len; /* floats per phase, padded to a multiple of 16 */
+	float *coef;
+	int acc; /* position of the next output in the block, times L */
+};
+
+/* 19 kHz pilot PLL, the NCO phase wraps at 2^32, the loop filter runs
+ once every PLL_UPDATE samples and pulls at most PLL_PULL Hz off 19 kHz */
+#define PLL_TABLE_BITS 12
+#define PLL_TABLE_SIZE (1 << PLL_TABLE_BITS)
+#define PLL_UPDATE 16
+#define PLL_PULL 200
+
+struct pilot_pll
+{
+	uint32_t phase;
+	uint32_t inc; /* phase step per sample */
+	float step; /* nominal 19 kHz in cycles per sample */
+	float integ; /* loop filter integrator, cycles per update */
+	float integ_max; /* PLL_PULL in the same */
+	float kp;
+	float ki;
+	float lp; /* one pole of the lock detector, per update */
+	float in_phase; /* pilot * sin, A / 2 when locked */
+	float power; /* pilot^2, A^2 / 2 */
+	volatile int locked;
+};
+
+/* Goertzel detector of the 19 kHz pilot, bins at 17.5 and 20.5 kHz
+ give the noise floor around it */
+#define PILOT_WINDOW 4096
+#define PILOT_HITS 3
+
+struct pilot_detect
+{
+	float coef[3];
+	float s1[3];
+	float s2[3];
+	int count;
+	int hits; /* windows in a row disagreeing with present */
+	volatile int present;
+};
+
+struct lp_real
+{
+	float *br; /* [size - 1 history | block] of the FM demodulated signal */
+	float *bms; /* same for L+R and L-R, interleaved */
+	float *ob; /* output of one call, the resampler may produce more than it reads */
+	int ob_size;
+	float *fm;
+	float *fp;
+	float *fs;
+	struct resampler_f32 rs;
+	struct resampler_f32 rs_mono; /* stereo mode without pilot */
+	struct pilot_pll pll;
+	struct pilot_detect pd;
+	int size;
+	int rsize;
+	int mode;
+};
+
+/* one block of a demodulator on the worker pool (-P). Its thread
+ converts the input and cuts the block, a worker runs the decimator,
+ the discriminator and the stereo filters, and its thread takes the
+ results back in order for the stages that carry state from sample to
+ sample. Blocks overlap by one decimator window */
+struct demod_job
+{
+	struct demod_state *d;
+	float *in; /* decimator line, or channel IQ */
+	int prev; /* in starts with the window of the last output before the block */
+	float pre[2]; /* if not, the IQ sample before the block */
+	int nout;
+	int nmax;
+	float *fm; /* nout FM samples */
+	float *fir; /* L+R, pilot and L-R of them, nmax apart */
+	int present; /* pilot when the block was dealt out, else no fir */
+	int locked; /* pilot lock then, else no L-R in fir */
+	volatile int done;
+};
+
+struct demod_state
+{
+	int exit_flag;
+	pthread_t thread;
+	/* the planes below are carved out of one arena, see init_demod_arena */
+	void *arena;
+	/* points to buf_copy or to a held transfer buffer */
+	uint8_t *buf;
+	uint8_t *buf_copy;
+	uint32_t buf_size;
+	uint32_t buf_len;
+	/* downsampled IQ, or channel IQ with -E pfb */
+	float *lowpassed;
+	int lowpassed_size; /* floats */
+	int lp_len;
+	/* first stage low pass and downsample, rotate writes into its line */
+	struct decimator_f32 decim;
+	int lp_taps;
+	int multipass; /* run the stages one after the other over the block */
+	/* several stations from one capture, input is shifted instead of rotated */
+	int mixing;
+	struct mixer_f32 mix;
+	/* -E pfb, lowpassed is filled with channel IQ by the filter bank */
+	int channelized;
+	struct spsc_ring *input;
+	/* -P, blocks go through the worker pool */
+	struct demod_job *jobs;
+	int jobs_len;
+	int16_t lp_i_hist[10][6];
+	int16_t lp_q_hist[10][6];
+	/* FM and audio of the multipass stages */
+	float *work;
+	int work_size; /* floats */
+	int16_t *result;
+	int result_size; /* samples */
+	int result_len;
+	int16_t droop_i_hist[9];
+	int16_t droop_q_hist[9];
+	int offset_tuning;
+	int rate_in;
+	int rate_out;
+	int rate_out2;
+	int now_r, now_j;
+	int pre_r, pre_j;
+	float pre_r_f32, pre_j_f32;
+	int prev_index;
+	int downsample; /* min 1, max 256 */
+	int post_downsample;
+	int output_scale;
+	int squelch_level, conseq_squelch, squelch_hits, terminate_on_squelch;
+	int level; /* of the last input block, dBFS * 10 */
+	int downsample_passes;
+	int comp_fir_size;
+	int custom_atan;
+	double deemph;
+	int deemph_a;
+	int deemph_l;
+	int deemph_r;
+	float deemph_l_f32;
+	float deemph_r_f32;
+	float deemph_lambda;
+	float volume;
+	int now_lpr;
+	int prev_lpr_index;
+	struct lp_real lpr;
+	pthread_rwlock_t rw;
+	pthread_cond_t ready;
+	pthread_mutex_t ready_m;
+	struct output_state *output_target;
+};
+
+/* tables and kernels, once before anything else */
+void init_u8_f32_table();
+void init_atan_lut();
+const char *init_simd(int enable);
+
+/* zeroed and DSP_ALIGN aligned */
+void *dsp_alloc(size_t size);
+void dsp_free(void *p);
+
+/* the block buffers of d for input reads of block bytes, raw IQ or
+ channel IQ if channelized. buf_copy only if copy is set, the held
+ transfer buffers and the filter bank don't need it. after the
+ decimator settings, before init_lp_real_f32 */
+int init_demod_arena(struct demod_state *d, int block, int copy);
+void deinit_demod_arena(struct demod_state *d);
+
+int init_decimator_f32(struct decimator_f32 *f, int factor, int taps, int max_input);
+void deinit_decimator_f32(struct decimator_f32 *f);
+int decimate_f32(struct decimator_f32 *f, float *ob, int max_out);
+
+void init_mixer_f32(struct mixer_f32 *m, int shift, int rate);
+void mix_f32(struct mixer_f32 *m, float *iq, int len);
+
+int init_pfb_f32(struct pfb_f32 *p, int nch, int factor, int taps, int max_input);
+void deinit_pfb_f32(struct pfb_f32 *p);
+void pfb_u8(struct pfb_f32 *p, const uint8_t *buf, int len);
+int pfb_f32(struct pfb_f32 *p, const int *bins, int nbins, float **ob, int max_out);
+
+void init_pilot_pll(struct pilot_pll *p, int rate);
+void init_pilot_detect(struct pilot_detect *d, int rate);
+int init_resampler_f32(struct resampler_f32 *r, int rate_in, int rate_out, int taps, int channels, float cutoff);
+void deinit_resampler_f32(struct resampler_f32 *r);
+int resample_f32(struct resampler_f32 *r, const float *line, int n, float *ob, int ob_size);
+int init_lp_real_f32(struct demod_state *fm);
+void deinit_lp_real_f32(struct demod_state *fm);
+
+/* stages over the whole block, buf -> lowpassed -> work -> result */
+void rotate_90_u8_f32(struct demod_state *d);
+void u8_f32(struct demod_state *d);
+void mix_u8_f32(struct demod_state *d);
+void lp_f32(struct demod_state *d);
+void fm_demod_f32(struct demod_state *fm);
+void lp_real_f32(struct demod_state *fm);
+void deemph_filter_f32(struct demod_state *fm);
+void convert_f32_s16(struct demod_state *fm);
+
+/* the same on caller buffers, for tiles */
+void fm_demod_block(struct demod_state *fm, const float *ib, float *ob, int n);
+int lp_real_block(struct demod_state *fm, const float *ib, int len, float *ob, int ob_size);
+void deemph_block(struct demod_state *fm, float *ib, int n);
+void convert_block(struct demod_state *fm, const float *ib, int16_t *ob, int n);
+
+int rms(int16_t *samples, int len, int step);
+
+/* lowpassed input to S16 result, fused unless multipass is set */
+void full_demod(struct demod_state *d);
+
+/* the same split across threads, see struct demod_job */
+int init_demod_jobs(struct demod_state *d, int n);
+void deinit_demod_jobs(struct demod_state *d);
+void demod_job_start(struct demod_state *d, struct demod_job *j);
+void demod_job_cut(struct demod_state *d, struct demod_job *j);
+void demod_job_run(struct demod_job *j);
+void demod_job_finish(struct demod_state *d, struct demod_job *j);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * iq_file, raw IQ recordings of rtl_fm_player
+ * Based on rtl_fm_streamer by Albrecht Lohoefener
+ * Based on "rtl_fm", see http://sdr.osmocom.org/trac/wiki/rtl-sdr for details
+ *
+ * Copyright (C) 2012 by Steve Markgraf <steve@steve-m.de>
+ * Copyright (C) 2012 by Hoernchen <la@tfc-server.de>
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ * Copyright (C) 2013 by Elias Oenal <EliasOenal@gmail.com>
+ * Copyright (C) 2015 by Miroslav Slugen <thunder.m@email.cz>
+ * Copyright (C) 2015 by Albrecht Lohoefener <albrechtloh@gmx.de>
+ * Copyright (C) 2024 by Rafael Ferrari <rafaelbf@hotmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IQ_FILE_H
+#define IQ_FILE_H
+
+#include <stdint.h>
+
+/* raw IQ recording: a header page followed by the u8 IQ stream as it
+ came from the dongle, the recorder writes it through mmap windows of
+ IQREC_WINDOW */
+#define IQREC_MAGIC				"RTLFMIQ1"
+#define IQREC_HEADER_SIZE		4096
+#define IQREC_WINDOW			(64 * 1024 * 1024)
+
+/* little endian, as the hosts we run on */
+struct iq_header
+{
+	char magic[8];
+	uint32_t header_size;
+	uint32_t freq; /* center of the capture, Hz */
+	uint32_t rate; /* samples per second */
+	int32_t ppm;
+	int32_t gain; /* tenths of a dB, AUTO_GAIN for automatic */
+	uint32_t reserved;
+	uint64_t data_len; /* bytes of IQ after the header */
+	int64_t start_time;
+};
+
+#endif
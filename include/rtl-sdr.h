@@ -372,6 +372,42 @@ RTLSDR_API int rtlsdr_read_async(rtlsdr_dev_t *dev,
 				 uint32_t buf_num,
 				 uint32_t buf_len);
 
+/*!
+ * Read samples from the device asynchronously without copying them. Like
+ * rtlsdr_read_async(), but the callback takes ownership of each transfer
+ * buffer (zero-copy buffers included) and has to give it back with
+ * rtlsdr_release_buffer(). Meanwhile the transfer continues with one of
+ * the spare buffers, if none is left it waits for the next release.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param cb callback function to return received samples
+ * \param ctx user specific context to pass via the callback function
+ * \param buf_num optional buffer count, set to 0 for default (15)
+ * \param buf_len optional buffer length, see rtlsdr_read_async()
+ * \param spare_num buffers that can be held by the caller without
+ *		  stalling the transfers
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_read_async_hold(rtlsdr_dev_t *dev,
+				      rtlsdr_read_async_cb_t cb,
+				      void *ctx,
+				      uint32_t buf_num,
+				      uint32_t buf_len,
+				      uint32_t spare_num);
+
+/*!
+ * Give a buffer received in rtlsdr_read_async_hold() mode back to the
+ * device. Can be called from any thread, also from the callback. Buffers
+ * still held when rtlsdr_read_async_hold() returns stay valid until they
+ * are released, the next read is started or the device is closed.
+ * Releasing them after the stream has stopped does nothing else.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param buf buffer pointer as passed to the callback
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_release_buffer(rtlsdr_dev_t *dev, unsigned char *buf);
+
 /*!
  * Cancel all pending asynchronous operations on the device.
  *
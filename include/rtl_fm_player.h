@@ -26,32 +26,60 @@
  */
 
 #include "rtl-sdr.h"
+#include "fm_dsp.h"
+#include "iq_file.h"
+#include "timeshift.h"
 
 #define DEFAULT_SAMPLE_RATE		240000
-#define DEFAULT_BUF_LENGTH		(1 * 16384)
-#define MAXIMUM_OVERSAMPLE		16
-#define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
 #define AUTO_GAIN				100
 #define BUFFER_DUMP				4096
 
 #define FREQUENCIES_LIMIT		1000
+/* stations demodulated from one capture, see -C */
+#define CHANNELS_LIMIT			16
+/* timeshift of the channels that are only recorded, in kbytes */
+#define CHANNEL_TIMESHIFT		16384
+/* demodulator rate with -E pfb, the filter bank channels are half of it
+ apart and land on the 100 kHz FM grid */
+#define PFB_CHANNEL_RATE		200000
+#define PFB_TAPS				8
+/* channel IQ per demodulator read, 8192 samples, and per filter bank pass */
+#define PFB_READ				(MAXIMUM_BUF_LENGTH / 4)
+#define PFB_BLOCK				4096
 
-#define PI2_F           6.28318531f
-#define PI_F            3.14159265f
-#define PI_2_F          1.5707963f
-#define PI_4_F          0.78539816f
 
-#define DEEMPHASIS_NONE         0
-#define DEEMPHASIS_FM_EU        0.000050
-#define DEEMPHASIS_FM_USA       0.000075
-
-
-// circular buffer for timeshift
-char * _circbuffer;
-static volatile int _circbuffeshift;
-static volatile int _circbufferslots;
 // #define CIRCBUFFCLUSTER 16384
 #define CIRCBUFFCLUSTER 32768
+/* default -M with a -S spill file */
+#define TIMESHIFT_SPILL_MINUTES	120
+/* between the demodulator and the output thread of every channel, in seconds of stereo S16 */
+#define OUTPUT_BUFFER_SECONDS	2
+/* input rings hold about this much IQ, within 4 and 16 blocks */
+#define INPUT_RING_MS			500
+
+/* -E lowlat: small USB transfers and demodulator reads, 10 ms timeshift
+ slots and an audio device queue kept near the target */
+#define LOWLAT_READ				DEFAULT_BUF_LENGTH
+#define LOWLAT_CLUSTER_MS		10
+#define LOWLAT_TARGET_MS		40
+#define LOWLAT_PAD				2	/* silent clusters queued after an underrun */
+#define LOWLAT_SDL_SAMPLES		512
+
+/* -E pull: the audio callback plays this many slots behind the newest
+ one, and starts over there once it is late by PULL_SLACK more */
+#define PULL_LEAD				2
+#define PULL_SLACK				4
+
+/* [A]/[D] seek this far, with a crossfade of SEEK_FADE_MS */
+#define SEEK_STEP_MS			3000
+#define SEEK_FADE_MS			15
+
+/* [E] exports the last EXPORT_MINUTES unless told otherwise, in writes
+ of EXPORT_CHUNK at multiples of it in the file. What the timeshift will
+ reuse within EXPORT_GUARD_MS is copied out ahead of the writes */
+#define EXPORT_MINUTES			5
+#define EXPORT_CHUNK			(1024 * 1024)
+#define EXPORT_GUARD_MS			60000
 
 static volatile int _beverbose = 0;
 static volatile int _do_exit = 0;
@@ -60,23 +88,73 @@ static int lcm_post[17] = { 1, 1, 1, 3, 1, 5, 3, 7, 1, 9, 5, 11, 3, 13, 7, 15, 1
 
 static int ACTUAL_BUF_LENGTH;
 
+static int _low_latency = 0;
+/* SDL calls output_audio_pull instead of being fed SDL_QueueAudio */
+static int _audio_pull = 0;
+/* -E compress, timeshift slots are packed */
+static int _ts_compress = 0;
+/* raw IQ bytes per USB transfer, demodulator or filter bank read,
+ and channel IQ bytes per read of a filter bank channel */
+static uint32_t _read_block = MAXIMUM_BUF_LENGTH;
+static uint32_t _channel_block = PFB_READ;
+
+
+#define CACHE_LINE_SIZE			64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ATOMIC_LOAD_ACQ(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_REL(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_FENCE()			__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define ATOMIC_LOAD_ACQ(p)		(MemoryBarrier(), *(p))
+#define ATOMIC_STORE_REL(p, v)	do { MemoryBarrier(); *(p) = (v); } while (0)
+#define ATOMIC_FENCE()			MemoryBarrier()
+#endif
+
+/* single producer, single consumer lock-free byte ring
+ head is written only by the producer, tail only by the consumer,
+ both are free running counters and kept on separate cache lines */
+struct spsc_ring
+{
+	char *buf;
+	uint32_t size; /* power of two */
+	uint32_t mask;
+	char pad0[CACHE_LINE_SIZE];
+	volatile uint32_t head;
+	char pad1[CACHE_LINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t tail;
+	char pad2[CACHE_LINE_SIZE - sizeof(uint32_t)];
+	/* consumer wakeup, seq changes on every wake */
+	volatile uint32_t seq;
+	volatile int waiting;
+	/* producer wakeup when room is made, offline input only waits */
+	volatile uint32_t room_seq;
+	volatile int room_waiting;
+	volatile int closed; /* the producer has written its last byte */
+	pthread_mutex_t wait_m;
+	pthread_cond_t wait_c;
+};
+
+/* sized from the sample rate by input_ring_size() */
+static char *_input_buffer;
+static struct spsc_ring _input_ring;
+/* transfer buffer held by the demodulator in zero-copy mode */
+struct iq_block
+{
+	unsigned char *buf;
+	uint32_t len;
+};
 
-/* 8 MB */
-static char _input_buffer[16 * MAXIMUM_BUF_LENGTH];
-static char _output_buffer[16 * MAXIMUM_BUF_LENGTH];
-uint32_t _input_buffer_rpos = 0,
-         _input_buffer_wpos = 0,
-         _input_buffer_size = 0,
-         _input_buffer_size_max = 16 * MAXIMUM_BUF_LENGTH;
-uint32_t _output_buffer_rpos = 0,
-         _output_buffer_wpos = 0,
-         _output_buffer_size = 0,
-         _output_buffer_size_max = 16 * MAXIMUM_BUF_LENGTH;
+#define HOLD_SPARE_BUFFERS		16
+
+static char _block_ring_buffer[64 * sizeof(struct iq_block)];
+static struct spsc_ring _block_ring;
 
 // win32 libzplay dll
 //ZPLAY_HANDLE libzplay;
 
 static SDL_AudioDeviceID _audio_device;
+static int _audio_device_samples;
 //static SDL_AudioStream *_audio_stream;
 
 int _audio_muted;
@@ -92,23 +170,6 @@ typedef enum
 bool _isStartStream;
 
 
-struct lp_real
-{
-	float *br;
-	float *bm;
-	float *bs;
-	float *fm;
-	float *fp;
-	float *fs;
-	float swf;
-	float cwf;
-	float pp;
-	int pos;
-	int size;
-	int rsize;
-	int mode;
-};
-
 struct dongle_state
 {
 	int exit_flag;
@@ -121,57 +182,34 @@ struct dongle_state
 	int ppm_error;
 	int direct_sampling;
 	int mute;
+	int zerocopy;
 	struct demod_state *demod_target;
+	const struct input_source *source;
+	/* offline input, raw u8 IQ as written by rtl_sdr */
+	char *in_name;
+	FILE *in_file;
+	int pace; /* feed the file at the sample rate instead of full speed */
+	int eof; /* nothing more will be written to the input ring */
 };
 
-struct demod_state
+/* where the IQ samples come from, thread_fn feeds the input ring */
+struct input_source
 {
-	int exit_flag;
-	pthread_t thread;
-	uint8_t buf[MAXIMUM_BUF_LENGTH];
-	uint32_t buf_len;
-	/* required 4 bytes for F32 part */
-	int16_t lowpassed[MAXIMUM_BUF_LENGTH << 1];
-	int lp_len;
-	/* tmp buffer for low pass filter F32 */
-	float lowpass_tb[48];
-	int16_t lp_i_hist[10][6];
-	int16_t lp_q_hist[10][6];
-	/* result buffer fo FM will be always 1/2 of lowpassed or less, so no need to shift */
-	int16_t result[MAXIMUM_BUF_LENGTH];
-	int result_len;
-	int16_t droop_i_hist[9];
-	int16_t droop_q_hist[9];
-	int offset_tuning;
-	int rate_in;
-	int rate_out;
-	int rate_out2;
-	int now_r, now_j;
-	int pre_r, pre_j;
-	float pre_r_f32, pre_j_f32;
-	int prev_index;
-	int downsample; /* min 1, max 256 */
-	int post_downsample;
-	int output_scale;
-	int squelch_level, conseq_squelch, squelch_hits, terminate_on_squelch;
-	int downsample_passes;
-	int comp_fir_size;
-	int custom_atan;
-	double deemph;
-	int deemph_a;
-	int deemph_l;
-	int deemph_r;
-	float deemph_l_f32;
-	float deemph_r_f32;
-	float deemph_lambda;
-	float volume;
-	int now_lpr;
-	int prev_lpr_index;
-	struct lp_real lpr;
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
-	struct output_state *output_target;
+	const char *name;
+	void *(*thread_fn)(void *arg);
+	void (*cancel)(struct dongle_state *s);
+};
+
+/* a read position in the timeshift history. After a seek, where it was
+ before is crossfaded into the new one for SEEK_FADE_MS */
+struct output_cursor
+{
+	struct ts_reader r;
+	uint64_t pos; /* bytes */
+	int shift; /* the circbuffershift pos was set for, -1 none yet */
+	uint64_t from; /* the old position while fading */
+	uint32_t fade; /* frames left */
+	char *mix;
 };
 
 struct output_state
@@ -183,8 +221,40 @@ struct output_state
 	int rate;
 	int16_t *result;
 	int result_len;
+	int eof; /* the demodulator has finished an offline input */
+	int play; /* this channel goes to the audio device */
+	int drained; /* the last sample of the offline input is out */
+	/* S16 audio from the demodulator, taken out in CIRCBUFFCLUSTER pieces */
+	char *buffer;
+	uint32_t buffer_rpos;
+	uint32_t buffer_wpos;
+	uint32_t buffer_size;
+	uint32_t buffer_size_max;
+	/* timeshift history, in slots of cluster bytes */
+	uint32_t cluster;
+	struct timeshift ts;
+	volatile int circbufferslots;
+	volatile int circbuffershift; /* frames behind the newest */
+	/* for the tags of the slots */
+	volatile uint32_t freq;
+	volatile int level;
+	int64_t tagged_ms;
+	uint32_t fade_frames;
+	struct output_cursor cur; /* output thread */
+	char *played; /* the cluster it sends */
+	/* -E pull: the callback reads behind ts.written */
+	struct output_cursor pull;
+	/* -E lowlat */
+	char *silence;
+	int frame; /* bytes per sample of all channels */
+	volatile uint32_t latency_ms; /* from the dongle to the speaker */
+	uint32_t trimmed;
+	uint32_t padded;
+	uint32_t reports; /* clusters since the last -v report */
 	pthread_rwlock_t rw;
+	/* a cluster is buffered / an offline demodulator has room again */
 	pthread_cond_t ready;
+	pthread_cond_t room;
 	pthread_mutex_t ready_m;
 };
 
@@ -201,9 +271,67 @@ struct controller_state
 	pthread_mutex_t hop_m;
 };
 
+/* the USB thread only copies into a staging ring of IQREC_STAGE, about
+ 7 s at 2.4 MS/s, the recorder thread maps, reserves and writes back the
+ file and finishes it, however long the card takes */
+#define IQREC_STAGE				(32 * 1024 * 1024)
+#define IQREC_CHUNK				(1024 * 1024)
 
-float RMSShadowBuf[MAXIMUM_BUF_LENGTH << 1];
-int RMSShadowBuf_len;
+struct iq_recorder
+{
+	volatile int active; /* the stream is taken */
+	volatile int writing; /* the producer is in iqrec_write */
+	int running; /* the thread is to be joined */
+	pthread_t thread;
+	struct spsc_ring ring;
+	char *ring_buf;
+	volatile uint64_t dropped; /* bytes that found the ring full */
+	struct iq_header hdr;
+	char filename[64];
+#ifdef _WIN32
+	FILE *file;
+	char *chunk; /* IQREC_CHUNK out of the ring at a time */
+#else
+	int fd;
+	uint8_t *map; /* current window */
+	uint64_t map_off; /* file offset of the window */
+	uint32_t map_pos; /* bytes used in it */
+#endif
+};
+
+/* [E], a range of the timeshift written to a WAV file by its own thread.
+ It never holds the output thread up, the slots about to be reused are
+ copied out first instead */
+struct wav_export
+{
+	volatile int active;
+	pthread_t thread;
+	struct output_state *s;
+	char filename[64];
+	FILE *file;
+	uint64_t from; /* bytes of the history */
+	uint64_t len;
+	uint64_t staged; /* of len, copied out */
+	uint64_t done; /* of len, in the file */
+	volatile int percent;
+	uint64_t lost; /* gone before they were copied out */
+	int failed;
+	struct ts_reader r;
+	char *stage; /* cap bytes, at file offsets modulo cap */
+	uint32_t cap;
+};
+
+/* one more station out of the same capture, with its own input ring,
+ demodulator thread, timeshift buffer and WAV file */
+struct channel_state
+{
+	uint32_t freq;
+	struct demod_state demod;
+	struct output_state output;
+	struct spsc_ring ring;
+	char *ring_buf;
+	char filename[64];
+};
 
 
 // multiple of these, eventually
@@ -211,6 +339,58 @@ struct dongle_state dongle;
 struct demod_state demod;
 struct output_state output;
 struct controller_state controller;
+struct iq_recorder iqrec;
+struct wav_export wavexp;
+/* the extra channels, the main one is still dongle/demod/output */
+static struct channel_state *_channels[CHANNELS_LIMIT];
+static int _channel_count = 0;
+
+/* -E pfb, one thread splits the capture for every channel and feeds
+ them decimated float IQ instead of the raw input */
+struct pfb_state
+{
+	int active;
+	pthread_t thread;
+	struct pfb_f32 bank;
+	int nbins;
+	int bins[CHANNELS_LIMIT]; /* the main channel first */
+	struct spsc_ring *out[CHANNELS_LIMIT];
+	float *ob[CHANNELS_LIMIT];
+	/* input of the main channel */
+	struct spsc_ring ring;
+	char *ring_buf;
+};
+
+static struct pfb_state _pfb;
+
+/* -P, worker threads shared by all demodulators. Every worker has its
+ own queue, the jobs are dealt out in turn, an idle worker takes the
+ oldest job of its queue or steals the newest one of another */
+#define POOL_MAX_WORKERS		16
+#define POOL_QUEUE				512
+
+struct pool_worker
+{
+	pthread_t thread;
+	struct demod_job *job[POOL_QUEUE];
+	uint32_t head; /* oldest */
+	uint32_t tail;
+	pthread_mutex_t m;
+};
+
+struct work_pool
+{
+	int workers;
+	struct pool_worker w[POOL_MAX_WORKERS];
+	int next; /* queue of the next job */
+	int queued; /* jobs in all queues */
+	int exit;
+	pthread_mutex_t m;
+	pthread_cond_t work;
+	pthread_cond_t done;
+};
+
+static struct work_pool _pool;
 
 
 static const char _WAVHeaderStereo[] = {
@@ -269,13 +449,3 @@ int cic_9_tables[][10] =
 { 9, -119, -577, 5917, -26067, 77473, -26067, 5917, -577, -119 },
 { 9, -199, -362, 5303, -25505, 77489, -25505, 5303, -362, -199 }, };
 
-
-/* table for u8 -> f32 conversion, 0 = positive, 1 = negative */
-static float u8_f32_table[2][256] =
-{
-{ 0 },
-{ 0 } };
-
-/* table with low pass filter coeficients */
-static float lp_filter_f32[16] =
-{ 0 };
@@ -0,0 +1,124 @@
+/*
+ * timeshift, the audio history of rtl_fm_player
+ * Based on rtl_fm_streamer by Albrecht Lohoefener
+ * Based on "rtl_fm", see http://sdr.osmocom.org/trac/wiki/rtl-sdr for details
+ *
+ * Copyright (C) 2012 by Steve Markgraf <steve@steve-m.de>
+ * Copyright (C) 2012 by Hoernchen <la@tfc-server.de>
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ * Copyright (C) 2013 by Elias Oenal <EliasOenal@gmail.com>
+ * Copyright (C) 2015 by Miroslav Slugen <thunder.m@email.cz>
+ * Copyright (C) 2015 by Albrecht Lohoefener <albrechtloh@gmx.de>
+ * Copyright (C) 2024 by Rafael Ferrari <rafaelbf@hotmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include <stdint.h>
+
+/* the history is a ring of fixed size slots, numbered by how many were
+ written before them. Without a spill file it is all in RAM. With one,
+ only the newest TS_HOT bytes stay in RAM and every slot is also written
+ through to the file, which is mapped TS_CHUNK at a time. Compressed,
+ the newest TS_HOT bytes stay as they are and every slot is also packed
+ into a byte ring the size of the uncompressed history, found through an
+ index of up to TS_PACK_RATIO times as many slots */
+#define TS_HOT					(8 * 1024 * 1024)
+#define TS_CHUNK				(16 * 1024 * 1024)
+#define TS_PACK_RATIO			8
+
+/* what the index knows of a slot, kept next to it for as long as the
+ slot is in the history */
+struct ts_tag
+{
+	int64_t ms; /* wall clock at its first sample, since the epoch */
+	uint32_t freq; /* tuned, Hz */
+	int16_t level; /* of the input, dBFS * 10 */
+};
+
+/* a mapped chunk of the spill file, every thread reading old slots
+ keeps its own */
+struct ts_reader
+{
+	char *map;
+	int64_t chunk; /* -1 none */
+	/* the last slot unpacked */
+	char *pcm;
+	uint8_t *copy;
+	int32_t *work;
+	uint32_t pcm_n;
+	int pcm_ok;
+};
+
+struct timeshift
+{
+	uint32_t slot_size;
+	int slots; /* of history */
+	int hot_slots; /* in RAM, all of them without a spill file */
+	char *hot;
+	volatile uint32_t written; /* slots ever committed */
+	struct ts_tag *tags; /* one per slot */
+	/* spill file, removed as soon as it is open */
+	int chunk_slots; /* 0 without */
+	int fd;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+	struct ts_reader w;
+	/* compressed, 16 bit PCM frames of frame bytes */
+	int frame; /* 0 without */
+	char *packed;
+	uint64_t packed_size;
+	uint64_t packed_end; /* bytes ever packed, writer only */
+	uint64_t *pos; /* of every slot in the index, from the start */
+	uint32_t *len;
+	volatile uint32_t oldest; /* first slot still packed */
+	char *out; /* writer scratch */
+	int32_t *work;
+};
+
+/* ts_init leaves t safe to close. path NULL keeps all slots in RAM,
+ packed if frame is 2 or 4 (mono or stereo S16) and raw if it is 0.
+ A spill file keeps them raw. returns -1 if the memory or the file
+ can't be had */
+void ts_init(struct timeshift *t);
+int ts_open(struct timeshift *t, uint32_t slot_size, int slots, const char *path, int frame);
+void ts_close(struct timeshift *t);
+
+/* where the writer puts slot number t->written, then ts_commit with
+ its tag */
+char *ts_next(struct timeshift *t);
+int ts_commit(struct timeshift *t, const struct ts_tag *tag);
+
+/* slot n, one of the ts_depth newest committed ones. NULL if it is
+ gone or can't be read */
+const char *ts_slot(struct timeshift *t, struct ts_reader *r, uint32_t n);
+uint32_t ts_read(struct timeshift *t, struct ts_reader *r, uint64_t pos, char *dst, uint32_t len);
+uint32_t ts_depth(struct timeshift *t);
+
+/* the tag of slot n, -1 if it is gone. ts_find gives the newest slot
+ that started at or before ms, -1 if the history starts after it.
+ ts_freq_start gives the first slot of the run on the frequency of
+ slot n, n itself if it is gone */
+int ts_tag(struct timeshift *t, uint32_t n, struct ts_tag *tag);
+int ts_find(struct timeshift *t, int64_t ms, uint32_t *n);
+uint32_t ts_freq_start(struct timeshift *t, uint32_t n);
+void ts_reader_init(struct ts_reader *r);
+void ts_reader_free(struct timeshift *t, struct ts_reader *r);
+
+#endif
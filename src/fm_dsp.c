@@ -0,0 +1,2193 @@
+/*
+ * fm_dsp, the float FM demodulator of rtl_fm_player
+ * Based on rtl_fm_streamer by Albrecht Lohoefener
+ * Based on "rtl_fm", see http://sdr.osmocom.org/trac/wiki/rtl-sdr for details
+ *
+ * Copyright (C) 2012 by Steve Markgraf <steve@steve-m.de>
+ * Copyright (C) 2012 by Hoernchen <la@tfc-server.de>
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ * Copyright (C) 2013 by Elias Oenal <EliasOenal@gmail.com>
+ * Copyright (C) 2015 by Miroslav Slugen <thunder.m@email.cz>
+ * Copyright (C) 2015 by Albrecht Lohoefener <albrechtloh@gmx.de>
+ * Copyright (C) 2024 by Rafael Ferrari <rafaelbf@hotmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_SIMD_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#include "fm_dsp.h"
+
+/* atan on 0 ... 1, one extra entry for the interpolation */
+#define ATAN_LUT_SIZE 1024
+static float atan_lut_f32[ATAN_LUT_SIZE + 1] =
+{ 0 };
+
+/* one cycle of sine for the pilot NCO */
+static float pll_sin_table[PLL_TABLE_SIZE] =
+{ 0 };
+
+/* table for u8 -> f32 conversion, 0 = positive, 1 = negative */
+static float u8_f32_table[2][256] =
+{
+{ 0 },
+{ 0 } };
+
+void init_u8_f32_table()
+{
+  int i;
+
+  for (i = 0; i < 256; i++)
+  {
+    u8_f32_table[0][i] = ((float) i - 127.5f) / 128.0f;
+    u8_f32_table[1][i] = ((float) i - 127.5f) / -128.0f;
+  }
+}
+
+static void rotate_90_u8_f32_c(const uint8_t *in, float *ob, uint32_t len)
+/* 90 rotation is 1+0j, 0+1j, -1+0j, 0-1j
+ or [0, 1, -3, 2, -4, -5, 7, -6] */
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i += 8)
+  {
+    ob[i] = u8_f32_table[0][in[i]];
+    ob[i + 1] = u8_f32_table[0][in[i + 1]];
+    ob[i + 2] = u8_f32_table[1][in[i + 3]];
+    ob[i + 3] = u8_f32_table[0][in[i + 2]];
+    ob[i + 4] = u8_f32_table[1][in[i + 4]];
+    ob[i + 5] = u8_f32_table[1][in[i + 5]];
+    ob[i + 6] = u8_f32_table[0][in[i + 7]];
+    ob[i + 7] = u8_f32_table[1][in[i + 6]];
+  }
+}
+
+static void u8_f32_c(const uint8_t *in, float *ob, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i++)
+  {
+    ob[i] = u8_f32_table[0][in[i]];
+  }
+}
+
+/* SIMD versions compute (u8 - 127.5) / 128 as u8 * k + c with the sign of
+ the rotation folded into k and c, which is exact in float and gives the
+ same values as u8_f32_table */
+#ifdef USE_SIMD_X86
+__attribute__((target("sse2")))
+static void rotate_90_u8_f32_sse2(const uint8_t *in, float *ob, uint32_t len)
+{
+  const __m128i zero = _mm_setzero_si128();
+  /* [0, 1, -3, 2] and [-4, -5, 7, -6] */
+  const __m128 ka = _mm_setr_ps(1.f / 128.f, 1.f / 128.f, -1.f / 128.f, 1.f / 128.f);
+  const __m128 kb = _mm_setr_ps(-1.f / 128.f, -1.f / 128.f, 1.f / 128.f, -1.f / 128.f);
+  const __m128 ca = _mm_mul_ps(ka, _mm_set1_ps(-127.5f));
+  const __m128 cb = _mm_mul_ps(kb, _mm_set1_ps(-127.5f));
+  __m128i b, w;
+  __m128 v0, v1, v2, v3;
+  uint32_t i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    b = _mm_loadu_si128((const __m128i *) (in + i));
+    w = _mm_unpacklo_epi8(b, zero);
+    v0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+    v1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero));
+    w = _mm_unpackhi_epi8(b, zero);
+    v2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+    v3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero));
+    /* swap the last IQ pair of each group of 4 */
+    v0 = _mm_shuffle_ps(v0, v0, _MM_SHUFFLE(2, 3, 1, 0));
+    v1 = _mm_shuffle_ps(v1, v1, _MM_SHUFFLE(2, 3, 1, 0));
+    v2 = _mm_shuffle_ps(v2, v2, _MM_SHUFFLE(2, 3, 1, 0));
+    v3 = _mm_shuffle_ps(v3, v3, _MM_SHUFFLE(2, 3, 1, 0));
+    _mm_storeu_ps(ob + i, _mm_add_ps(_mm_mul_ps(v0, ka), ca));
+    _mm_storeu_ps(ob + i + 4, _mm_add_ps(_mm_mul_ps(v1, kb), cb));
+    _mm_storeu_ps(ob + i + 8, _mm_add_ps(_mm_mul_ps(v2, ka), ca));
+    _mm_storeu_ps(ob + i + 12, _mm_add_ps(_mm_mul_ps(v3, kb), cb));
+  }
+
+  rotate_90_u8_f32_c(in + i, ob + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static void u8_f32_sse2(const uint8_t *in, float *ob, uint32_t len)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 k = _mm_set1_ps(1.f / 128.f);
+  const __m128 c = _mm_set1_ps(-127.5f / 128.f);
+  __m128i b, w;
+  uint32_t i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    b = _mm_loadu_si128((const __m128i *) (in + i));
+    w = _mm_unpacklo_epi8(b, zero);
+    _mm_storeu_ps(ob + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero)), k), c));
+    _mm_storeu_ps(ob + i + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero)), k), c));
+    w = _mm_unpackhi_epi8(b, zero);
+    _mm_storeu_ps(ob + i + 8, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero)), k), c));
+    _mm_storeu_ps(ob + i + 12, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero)), k), c));
+  }
+
+  u8_f32_c(in + i, ob + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void rotate_90_u8_f32_avx2(const uint8_t *in, float *ob, uint32_t len)
+{
+  const __m256 k = _mm256_setr_ps(1.f / 128.f, 1.f / 128.f, -1.f / 128.f, 1.f / 128.f,
+                                  -1.f / 128.f, -1.f / 128.f, 1.f / 128.f, -1.f / 128.f);
+  const __m256 c = _mm256_mul_ps(k, _mm256_set1_ps(-127.5f));
+  __m256 v0, v1, v2, v3;
+  uint32_t i;
+
+  for (i = 0; i + 32 <= len; i += 32)
+  {
+    v0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + i))));
+    v1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + i + 8))));
+    v2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + i + 16))));
+    v3 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + i + 24))));
+    /* in lane shuffle, both halves get [0, 1, 3, 2] */
+    v0 = _mm256_permute_ps(v0, _MM_SHUFFLE(2, 3, 1, 0));
+    v1 = _mm256_permute_ps(v1, _MM_SHUFFLE(2, 3, 1, 0));
+    v2 = _mm256_permute_ps(v2, _MM_SHUFFLE(2, 3, 1, 0));
+    v3 = _mm256_permute_ps(v3, _MM_SHUFFLE(2, 3, 1, 0));
+    _mm256_storeu_ps(ob + i, _mm256_add_ps(_mm256_mul_ps(v0, k), c));
+    _mm256_storeu_ps(ob + i + 8, _mm256_add_ps(_mm256_mul_ps(v1, k), c));
+    _mm256_storeu_ps(ob + i + 16, _mm256_add_ps(_mm256_mul_ps(v2, k), c));
+    _mm256_storeu_ps(ob + i + 24, _mm256_add_ps(_mm256_mul_ps(v3, k), c));
+  }
+
+  rotate_90_u8_f32_c(in + i, ob + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void u8_f32_avx2(const uint8_t *in, float *ob, uint32_t len)
+{
+  const __m256 k = _mm256_set1_ps(1.f / 128.f);
+  const __m256 c = _mm256_set1_ps(-127.5f / 128.f);
+  uint32_t i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    _mm256_storeu_ps(ob + i, _mm256_add_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + i)))), k), c));
+    _mm256_storeu_ps(ob + i + 8, _mm256_add_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + i + 8)))), k), c));
+  }
+
+  u8_f32_c(in + i, ob + i, len - i);
+}
+#endif
+
+#ifdef USE_SIMD_NEON
+static void rotate_90_u8_f32_neon(const uint8_t *in, float *ob, uint32_t len)
+{
+  static const float kav[4] = { 1.f / 128.f, 1.f / 128.f, -1.f / 128.f, 1.f / 128.f };
+  static const float kbv[4] = { -1.f / 128.f, -1.f / 128.f, 1.f / 128.f, -1.f / 128.f };
+  const float32x4_t ka = vld1q_f32(kav);
+  const float32x4_t kb = vld1q_f32(kbv);
+  const float32x4_t ca = vmulq_n_f32(ka, -127.5f);
+  const float32x4_t cb = vmulq_n_f32(kb, -127.5f);
+  uint8x16_t b;
+  uint16x8_t w;
+  float32x4_t v0, v1, v2, v3;
+  uint32_t i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    b = vld1q_u8(in + i);
+    w = vmovl_u8(vget_low_u8(b));
+    v0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(w)));
+    v1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(w)));
+    w = vmovl_u8(vget_high_u8(b));
+    v2 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(w)));
+    v3 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(w)));
+    /* keep the first IQ pair, swap the second */
+    v0 = vcombine_f32(vget_low_f32(v0), vget_high_f32(vrev64q_f32(v0)));
+    v1 = vcombine_f32(vget_low_f32(v1), vget_high_f32(vrev64q_f32(v1)));
+    v2 = vcombine_f32(vget_low_f32(v2), vget_high_f32(vrev64q_f32(v2)));
+    v3 = vcombine_f32(vget_low_f32(v3), vget_high_f32(vrev64q_f32(v3)));
+    vst1q_f32(ob + i, vmlaq_f32(ca, v0, ka));
+    vst1q_f32(ob + i + 4, vmlaq_f32(cb, v1, kb));
+    vst1q_f32(ob + i + 8, vmlaq_f32(ca, v2, ka));
+    vst1q_f32(ob + i + 12, vmlaq_f32(cb, v3, kb));
+  }
+
+  rotate_90_u8_f32_c(in + i, ob + i, len - i);
+}
+
+static void u8_f32_neon(const uint8_t *in, float *ob, uint32_t len)
+{
+  const float32x4_t k = vdupq_n_f32(1.f / 128.f);
+  const float32x4_t c = vdupq_n_f32(-127.5f / 128.f);
+  uint8x16_t b;
+  uint16x8_t w;
+  uint32_t i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    b = vld1q_u8(in + i);
+    w = vmovl_u8(vget_low_u8(b));
+    vst1q_f32(ob + i, vmlaq_f32(c, vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))), k));
+    vst1q_f32(ob + i + 4, vmlaq_f32(c, vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))), k));
+    w = vmovl_u8(vget_high_u8(b));
+    vst1q_f32(ob + i + 8, vmlaq_f32(c, vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))), k));
+    vst1q_f32(ob + i + 12, vmlaq_f32(c, vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))), k));
+  }
+
+  u8_f32_c(in + i, ob + i, len - i);
+}
+#endif
+
+/* y = sum of x * c over n floats for every output, x advancing by step
+ floats, I and Q sums are kept apart by the duplicated coefficients */
+static void decimate_cf32_c(const float *x, const float *c, int n, int step, int nout, float *y)
+{
+  int i, k;
+  float i0, q0, i1, q1;
+
+  for (i = 0; i < nout; i++, x += step)
+  {
+    /* two chains each, n is a multiple of 16 */
+    i0 = q0 = i1 = q1 = 0;
+    for (k = 0; k < n; k += 4)
+    {
+      i0 += x[k] * c[k];
+      q0 += x[k + 1] * c[k + 1];
+      i1 += x[k + 2] * c[k + 2];
+      q1 += x[k + 3] * c[k + 3];
+    }
+    y[2 * i] = i0 + i1;
+    y[2 * i + 1] = q0 + q1;
+  }
+}
+
+/* acc = sum of the n / m floats long blocks of x * c, the branch sums
+ of the filter bank, m is a multiple of 8 */
+static void pfb_fold_cf32_c(const float *x, const float *c, int n, int m, float *acc)
+{
+  int i, k;
+
+  for (k = 0; k < m; k++)
+    acc[k] = x[k] * c[k];
+  for (i = m; i < n; i += m)
+  {
+    for (k = 0; k < m; k++)
+      acc[k] += x[i + k] * c[i + k];
+  }
+}
+
+/* in place radix 2 FFT of the bank on bit reversed input, e^+j and not
+ normalized. every element holds PFB_LANES consecutive outputs */
+static void pfb_ifft_c(const float *tw, int n, float (*xr)[PFB_LANES], float (*xj)[PFB_LANES])
+{
+  int half, step, i, j, l;
+  float wr, wj, vr, vj;
+
+  for (half = 1, step = n / 2; half < n; half <<= 1, step >>= 1)
+  {
+    for (j = 0; j < half; j++)
+    {
+      wr = tw[2 * j * step];
+      wj = tw[2 * j * step + 1];
+      for (i = j; i < n; i += 2 * half)
+      {
+        for (l = 0; l < PFB_LANES; l++)
+        {
+          vr = xr[i + half][l] * wr - xj[i + half][l] * wj;
+          vj = xr[i + half][l] * wj + xj[i + half][l] * wr;
+          xr[i + half][l] = xr[i][l] - vr;
+          xj[i + half][l] = xj[i][l] - vj;
+          xr[i][l] += vr;
+          xj[i][l] += vj;
+        }
+      }
+    }
+  }
+}
+
+#ifdef USE_SIMD_X86
+/* two outputs per pass share the coefficient loads */
+__attribute__((target("sse2")))
+static void decimate_cf32_sse2(const float *x, const float *c, int n, int step, int nout, float *y)
+{
+  int i, k;
+  __m128 a0, a1, b0, b1, h0, h1;
+
+  for (i = 0; i + 1 < nout; i += 2, x += 2 * step)
+  {
+    a0 = a1 = b0 = b1 = _mm_setzero_ps();
+    for (k = 0; k < n; k += 8)
+    {
+      h0 = _mm_loadu_ps(c + k);
+      h1 = _mm_loadu_ps(c + k + 4);
+      a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + k), h0));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), h1));
+      b0 = _mm_add_ps(b0, _mm_mul_ps(_mm_loadu_ps(x + step + k), h0));
+      b1 = _mm_add_ps(b1, _mm_mul_ps(_mm_loadu_ps(x + step + k + 4), h1));
+    }
+    a0 = _mm_add_ps(a0, a1);
+    b0 = _mm_add_ps(b0, b1);
+    /* [I0 Q0 I1 Q1] of both -> [Ia Qa Ib Qb] */
+    _mm_storeu_ps(y + 2 * i, _mm_add_ps(_mm_movelh_ps(a0, b0), _mm_movehl_ps(b0, a0)));
+  }
+
+  if (i < nout)
+  {
+    a0 = a1 = _mm_setzero_ps();
+    for (k = 0; k < n; k += 8)
+    {
+      a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(c + k)));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(c + k + 4)));
+    }
+    a0 = _mm_add_ps(a0, a1);
+    _mm_storel_pi((__m64 *) (y + 2 * i), _mm_add_ps(a0, _mm_movehl_ps(a0, a0)));
+  }
+}
+
+__attribute__((target("sse2")))
+static void pfb_fold_cf32_sse2(const float *x, const float *c, int n, int m, float *acc)
+{
+  int i, k;
+  __m128 a0, a1;
+
+  for (k = 0; k < m; k += 8)
+  {
+    a0 = _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(c + k));
+    a1 = _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(c + k + 4));
+    for (i = m; i < n; i += m)
+    {
+      a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + i + k), _mm_loadu_ps(c + i + k)));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + i + k + 4), _mm_loadu_ps(c + i + k + 4)));
+    }
+    _mm_storeu_ps(acc + k, a0);
+    _mm_storeu_ps(acc + k + 4, a1);
+  }
+}
+
+__attribute__((target("sse2")))
+static void pfb_ifft_sse2(const float *tw, int n, float (*xr)[PFB_LANES], float (*xj)[PFB_LANES])
+{
+  int half, step, i, j, l;
+  __m128 wr, wj, br, bj, vr, vj;
+
+  for (half = 1, step = n / 2; half < n; half <<= 1, step >>= 1)
+  {
+    for (j = 0; j < half; j++)
+    {
+      wr = _mm_set1_ps(tw[2 * j * step]);
+      wj = _mm_set1_ps(tw[2 * j * step + 1]);
+      for (i = j; i < n; i += 2 * half)
+      {
+        for (l = 0; l < PFB_LANES; l += 4)
+        {
+          br = _mm_loadu_ps(xr[i + half] + l);
+          bj = _mm_loadu_ps(xj[i + half] + l);
+          vr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bj, wj));
+          vj = _mm_add_ps(_mm_mul_ps(br, wj), _mm_mul_ps(bj, wr));
+          br = _mm_loadu_ps(xr[i] + l);
+          bj = _mm_loadu_ps(xj[i] + l);
+          _mm_storeu_ps(xr[i + half] + l, _mm_sub_ps(br, vr));
+          _mm_storeu_ps(xj[i + half] + l, _mm_sub_ps(bj, vj));
+          _mm_storeu_ps(xr[i] + l, _mm_add_ps(br, vr));
+          _mm_storeu_ps(xj[i] + l, _mm_add_ps(bj, vj));
+        }
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void pfb_ifft_avx2(const float *tw, int n, float (*xr)[PFB_LANES], float (*xj)[PFB_LANES])
+{
+  int half, step, i, j;
+  __m256 wr, wj, ar, aj, br, bj, vr, vj;
+
+  for (half = 1, step = n / 2; half < n; half <<= 1, step >>= 1)
+  {
+    for (j = 0; j < half; j++)
+    {
+      wr = _mm256_set1_ps(tw[2 * j * step]);
+      wj = _mm256_set1_ps(tw[2 * j * step + 1]);
+      for (i = j; i < n; i += 2 * half)
+      {
+        br = _mm256_loadu_ps(xr[i + half]);
+        bj = _mm256_loadu_ps(xj[i + half]);
+        vr = _mm256_fmsub_ps(br, wr, _mm256_mul_ps(bj, wj));
+        vj = _mm256_fmadd_ps(br, wj, _mm256_mul_ps(bj, wr));
+        ar = _mm256_loadu_ps(xr[i]);
+        aj = _mm256_loadu_ps(xj[i]);
+        _mm256_storeu_ps(xr[i + half], _mm256_sub_ps(ar, vr));
+        _mm256_storeu_ps(xj[i + half], _mm256_sub_ps(aj, vj));
+        _mm256_storeu_ps(xr[i], _mm256_add_ps(ar, vr));
+        _mm256_storeu_ps(xj[i], _mm256_add_ps(aj, vj));
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void pfb_fold_cf32_avx2(const float *x, const float *c, int n, int m, float *acc)
+{
+  int i, k;
+  __m256 a;
+
+  for (k = 0; k < m; k += 8)
+  {
+    a = _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(c + k));
+    for (i = m; i < n; i += m)
+      a = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + k), _mm256_loadu_ps(c + i + k), a);
+    _mm256_storeu_ps(acc + k, a);
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void decimate_cf32_avx2(const float *x, const float *c, int n, int step, int nout, float *y)
+{
+  int i, k;
+  __m256 a0, a1, b0, b1, h0, h1;
+  __m128 a, b;
+
+  for (i = 0; i + 1 < nout; i += 2, x += 2 * step)
+  {
+    a0 = a1 = b0 = b1 = _mm256_setzero_ps();
+    for (k = 0; k < n; k += 16)
+    {
+      h0 = _mm256_loadu_ps(c + k);
+      h1 = _mm256_loadu_ps(c + k + 8);
+      a0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), h0, a0);
+      a1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k + 8), h1, a1);
+      b0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + step + k), h0, b0);
+      b1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + step + k + 8), h1, b1);
+    }
+    a0 = _mm256_add_ps(a0, a1);
+    b0 = _mm256_add_ps(b0, b1);
+    a = _mm_add_ps(_mm256_castps256_ps128(a0), _mm256_extractf128_ps(a0, 1));
+    b = _mm_add_ps(_mm256_castps256_ps128(b0), _mm256_extractf128_ps(b0, 1));
+    _mm_storeu_ps(y + 2 * i, _mm_add_ps(_mm_movelh_ps(a, b), _mm_movehl_ps(b, a)));
+  }
+
+  if (i < nout)
+  {
+    a0 = a1 = _mm256_setzero_ps();
+    for (k = 0; k < n; k += 16)
+    {
+      a0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(c + k), a0);
+      a1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k + 8), _mm256_loadu_ps(c + k + 8), a1);
+    }
+    a0 = _mm256_add_ps(a0, a1);
+    a = _mm_add_ps(_mm256_castps256_ps128(a0), _mm256_extractf128_ps(a0, 1));
+    _mm_storel_pi((__m64 *) (y + 2 * i), _mm_add_ps(a, _mm_movehl_ps(a, a)));
+  }
+}
+#endif
+
+#ifdef USE_SIMD_NEON
+static void decimate_cf32_neon(const float *x, const float *c, int n, int step, int nout, float *y)
+{
+  int i, k;
+  float32x4_t a0, a1, b0, b1, h0, h1;
+
+  for (i = 0; i + 1 < nout; i += 2, x += 2 * step)
+  {
+    a0 = a1 = b0 = b1 = vdupq_n_f32(0);
+    for (k = 0; k < n; k += 8)
+    {
+      h0 = vld1q_f32(c + k);
+      h1 = vld1q_f32(c + k + 4);
+      a0 = vmlaq_f32(a0, vld1q_f32(x + k), h0);
+      a1 = vmlaq_f32(a1, vld1q_f32(x + k + 4), h1);
+      b0 = vmlaq_f32(b0, vld1q_f32(x + step + k), h0);
+      b1 = vmlaq_f32(b1, vld1q_f32(x + step + k + 4), h1);
+    }
+    a0 = vaddq_f32(a0, a1);
+    b0 = vaddq_f32(b0, b1);
+    vst1q_f32(y + 2 * i, vcombine_f32(vadd_f32(vget_low_f32(a0), vget_high_f32(a0)),
+        vadd_f32(vget_low_f32(b0), vget_high_f32(b0))));
+  }
+
+  if (i < nout)
+  {
+    a0 = a1 = vdupq_n_f32(0);
+    for (k = 0; k < n; k += 8)
+    {
+      a0 = vmlaq_f32(a0, vld1q_f32(x + k), vld1q_f32(c + k));
+      a1 = vmlaq_f32(a1, vld1q_f32(x + k + 4), vld1q_f32(c + k + 4));
+    }
+    a0 = vaddq_f32(a0, a1);
+    vst1_f32(y + 2 * i, vadd_f32(vget_low_f32(a0), vget_high_f32(a0)));
+  }
+}
+#endif
+
+#ifdef USE_SIMD_NEON
+static void pfb_ifft_neon(const float *tw, int n, float (*xr)[PFB_LANES], float (*xj)[PFB_LANES])
+{
+  int half, step, i, j, l;
+  float32x4_t ar, aj, br, bj, vr, vj;
+  float wr, wj;
+
+  for (half = 1, step = n / 2; half < n; half <<= 1, step >>= 1)
+  {
+    for (j = 0; j < half; j++)
+    {
+      wr = tw[2 * j * step];
+      wj = tw[2 * j * step + 1];
+      for (i = j; i < n; i += 2 * half)
+      {
+        for (l = 0; l < PFB_LANES; l += 4)
+        {
+          br = vld1q_f32(xr[i + half] + l);
+          bj = vld1q_f32(xj[i + half] + l);
+          vr = vmlsq_n_f32(vmulq_n_f32(br, wr), bj, wj);
+          vj = vmlaq_n_f32(vmulq_n_f32(br, wj), bj, wr);
+          ar = vld1q_f32(xr[i] + l);
+          aj = vld1q_f32(xj[i] + l);
+          vst1q_f32(xr[i + half] + l, vsubq_f32(ar, vr));
+          vst1q_f32(xj[i + half] + l, vsubq_f32(aj, vj));
+          vst1q_f32(xr[i] + l, vaddq_f32(ar, vr));
+          vst1q_f32(xj[i] + l, vaddq_f32(aj, vj));
+        }
+      }
+    }
+  }
+}
+
+static void pfb_fold_cf32_neon(const float *x, const float *c, int n, int m, float *acc)
+{
+  int i, k;
+  float32x4_t a0, a1;
+
+  for (k = 0; k < m; k += 8)
+  {
+    a0 = vmulq_f32(vld1q_f32(x + k), vld1q_f32(c + k));
+    a1 = vmulq_f32(vld1q_f32(x + k + 4), vld1q_f32(c + k + 4));
+    for (i = m; i < n; i += m)
+    {
+      a0 = vmlaq_f32(a0, vld1q_f32(x + i + k), vld1q_f32(c + i + k));
+      a1 = vmlaq_f32(a1, vld1q_f32(x + i + k + 4), vld1q_f32(c + i + k + 4));
+    }
+    vst1q_f32(acc + k, a0);
+    vst1q_f32(acc + k + 4, a1);
+  }
+}
+#endif
+
+/* Lagrange approximation of atan2, max error about 0.0015 rad.
+ atan(z) ~ z * (pi/4 - (z - 1) * (0.2447 + 0.0663 * z)) is evaluated
+ only on the first octant, the quadrant and |x| < |y| cases are applied
+ afterwards as reflections, so there is no data dependent branch */
+static float atan2_fast_f32(float y, float x)
+{
+  float ax = fabsf(x), ay = fabsf(y), mx, mn, z, a;
+
+  mx = (ax > ay) ? ax : ay;
+  mn = (ax > ay) ? ay : ax;
+  z = (mx > 0.f) ? mn / mx : 0.f;
+  a = z * (PI_4_F - (z - 1.f) * (0.2447f + 0.0663f * z));
+  a = (ay > ax) ? PI_2_F - a : a;
+  a = (x < 0.f) ? PI_F - a : a;
+
+  return (y < 0.f) ? -a : a;
+}
+
+/* same octant reduction with atan interpolated from atan_lut_f32 */
+static float atan2_lut_f32(float y, float x)
+{
+  float ax = fabsf(x), ay = fabsf(y), mx, mn, z, a;
+  int i;
+
+  mx = (ax > ay) ? ax : ay;
+  mn = (ax > ay) ? ay : ax;
+  z = (mx > 0.f) ? mn / mx * (float) ATAN_LUT_SIZE : 0.f;
+  i = (int) z;
+  i = (i < ATAN_LUT_SIZE) ? i : ATAN_LUT_SIZE - 1;
+  z -= (float) i;
+  a = atan_lut_f32[i] + z * (atan_lut_f32[i + 1] - atan_lut_f32[i]);
+  a = (ay > ax) ? PI_2_F - a : a;
+  a = (x < 0.f) ? PI_F - a : a;
+
+  return (y < 0.f) ? -a : a;
+}
+
+void init_atan_lut()
+{
+  int i;
+
+  for (i = 0; i <= ATAN_LUT_SIZE; i++)
+    atan_lut_f32[i] = atanf((float) i / (float) ATAN_LUT_SIZE);
+}
+
+/* FM polar discriminator, phase difference of n IQ samples,
+ p holds the last sample of the previous block and is updated */
+static void polar_disc_std(const float *in, float *ob, int n, float *p)
+{
+  int i;
+  float pr = p[0], pj = p[1];
+
+  for (i = 0; i < n; i++)
+  {
+    ob[i] = atan2f(pr * in[2 * i + 1] - pj * in[2 * i], in[2 * i] * pr + in[2 * i + 1] * pj);
+    pr = in[2 * i];
+    pj = in[2 * i + 1];
+  }
+  p[0] = pr;
+  p[1] = pj;
+}
+
+static void polar_disc_lut(const float *in, float *ob, int n, float *p)
+{
+  int i;
+  float pr = p[0], pj = p[1];
+
+  for (i = 0; i < n; i++)
+  {
+    ob[i] = atan2_lut_f32(pr * in[2 * i + 1] - pj * in[2 * i], in[2 * i] * pr + in[2 * i + 1] * pj);
+    pr = in[2 * i];
+    pj = in[2 * i + 1];
+  }
+  p[0] = pr;
+  p[1] = pj;
+}
+
+static void polar_disc_fast_c(const float *in, float *ob, int n, float *p)
+{
+  int i;
+  float pr = p[0], pj = p[1];
+
+  for (i = 0; i < n; i++)
+  {
+    ob[i] = atan2_fast_f32(pr * in[2 * i + 1] - pj * in[2 * i], in[2 * i] * pr + in[2 * i + 1] * pj);
+    pr = in[2 * i];
+    pj = in[2 * i + 1];
+  }
+  p[0] = pr;
+  p[1] = pj;
+}
+
+/* the vector versions do the first sample with p, after that the
+ previous sample is just the input read one IQ pair earlier */
+#ifdef USE_SIMD_X86
+__attribute__((target("sse2")))
+static inline __m128 atan2_fast_sse2(__m128 y, __m128 x)
+{
+  const __m128 sign = _mm_set1_ps(-0.f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+  __m128 ax, ay, mx, z, a, m;
+
+  ax = _mm_andnot_ps(sign, x);
+  ay = _mm_andnot_ps(sign, y);
+  mx = _mm_max_ps(ax, ay);
+  /* 0 / 0 gives NaN, masked to 0 */
+  z = _mm_and_ps(_mm_div_ps(_mm_min_ps(ax, ay), mx), _mm_cmpgt_ps(mx, zero));
+  a = _mm_add_ps(_mm_set1_ps(0.2447f), _mm_mul_ps(_mm_set1_ps(0.0663f), z));
+  a = _mm_mul_ps(z, _mm_sub_ps(_mm_set1_ps(PI_4_F), _mm_mul_ps(_mm_sub_ps(z, one), a)));
+  m = _mm_cmpgt_ps(ay, ax);
+  a = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(PI_2_F), a)), _mm_andnot_ps(m, a));
+  m = _mm_cmplt_ps(x, zero);
+  a = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(PI_F), a)), _mm_andnot_ps(m, a));
+
+  return _mm_xor_ps(a, _mm_and_ps(_mm_cmplt_ps(y, zero), sign));
+}
+
+__attribute__((target("sse2")))
+static void polar_disc_fast_sse2(const float *in, float *ob, int n, float *p)
+{
+  int i;
+  __m128 a, b, cr, cj, pr, pj;
+
+  if (n < 5)
+  {
+    polar_disc_fast_c(in, ob, n, p);
+    return;
+  }
+  polar_disc_fast_c(in, ob, 1, p);
+
+  for (i = 1; i + 4 <= n; i += 4)
+  {
+    a = _mm_loadu_ps(in + 2 * i);
+    b = _mm_loadu_ps(in + 2 * i + 4);
+    cr = _mm_shuffle_ps(a, b, 0x88);
+    cj = _mm_shuffle_ps(a, b, 0xdd);
+    a = _mm_loadu_ps(in + 2 * i - 2);
+    b = _mm_loadu_ps(in + 2 * i + 2);
+    pr = _mm_shuffle_ps(a, b, 0x88);
+    pj = _mm_shuffle_ps(a, b, 0xdd);
+    _mm_storeu_ps(ob + i, atan2_fast_sse2(_mm_sub_ps(_mm_mul_ps(pr, cj), _mm_mul_ps(pj, cr)),
+        _mm_add_ps(_mm_mul_ps(cr, pr), _mm_mul_ps(cj, pj))));
+  }
+
+  p[0] = in[2 * i - 2];
+  p[1] = in[2 * i - 1];
+  polar_disc_fast_c(in + 2 * i, ob + i, n - i, p);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 atan2_fast_avx2(__m256 y, __m256 x)
+{
+  const __m256 sign = _mm256_set1_ps(-0.f), zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+  __m256 ax, ay, mx, z, a;
+
+  ax = _mm256_andnot_ps(sign, x);
+  ay = _mm256_andnot_ps(sign, y);
+  mx = _mm256_max_ps(ax, ay);
+  z = _mm256_and_ps(_mm256_div_ps(_mm256_min_ps(ax, ay), mx), _mm256_cmp_ps(mx, zero, _CMP_GT_OQ));
+  a = _mm256_fmadd_ps(_mm256_set1_ps(0.0663f), z, _mm256_set1_ps(0.2447f));
+  a = _mm256_mul_ps(z, _mm256_fnmadd_ps(_mm256_sub_ps(z, one), a, _mm256_set1_ps(PI_4_F)));
+  a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(PI_2_F), a), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+  a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(PI_F), a), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+
+  return _mm256_xor_ps(a, _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), sign));
+}
+
+__attribute__((target("avx2,fma")))
+static void polar_disc_fast_avx2(const float *in, float *ob, int n, float *p)
+{
+  int i;
+  __m256 a, b, cr, cj, pr, pj, v;
+
+  if (n < 9)
+  {
+    polar_disc_fast_c(in, ob, n, p);
+    return;
+  }
+  polar_disc_fast_c(in, ob, 1, p);
+
+  for (i = 1; i + 8 <= n; i += 8)
+  {
+    /* lane wise deinterleave leaves the order 0 1 4 5 2 3 6 7 */
+    a = _mm256_loadu_ps(in + 2 * i);
+    b = _mm256_loadu_ps(in + 2 * i + 8);
+    cr = _mm256_shuffle_ps(a, b, 0x88);
+    cj = _mm256_shuffle_ps(a, b, 0xdd);
+    a = _mm256_loadu_ps(in + 2 * i - 2);
+    b = _mm256_loadu_ps(in + 2 * i + 6);
+    pr = _mm256_shuffle_ps(a, b, 0x88);
+    pj = _mm256_shuffle_ps(a, b, 0xdd);
+    v = atan2_fast_avx2(_mm256_fmsub_ps(pr, cj, _mm256_mul_ps(pj, cr)),
+        _mm256_fmadd_ps(cr, pr, _mm256_mul_ps(cj, pj)));
+    v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), 0xd8));
+    _mm256_storeu_ps(ob + i, v);
+  }
+
+  p[0] = in[2 * i - 2];
+  p[1] = in[2 * i - 1];
+  polar_disc_fast_c(in + 2 * i, ob + i, n - i, p);
+}
+#endif
+
+#ifdef USE_SIMD_NEON
+static inline float32x4_t atan2_fast_neon(float32x4_t y, float32x4_t x)
+{
+  const float32x4_t zero = vdupq_n_f32(0.f);
+  float32x4_t ax, ay, mx, z, a;
+
+  ax = vabsq_f32(x);
+  ay = vabsq_f32(y);
+  mx = vmaxq_f32(ax, ay);
+#ifdef __aarch64__
+  z = vdivq_f32(vminq_f32(ax, ay), mx);
+#else
+  /* no divide on armv7, two newton steps on the reciprocal estimate */
+  a = vrecpeq_f32(mx);
+  a = vmulq_f32(a, vrecpsq_f32(mx, a));
+  a = vmulq_f32(a, vrecpsq_f32(mx, a));
+  z = vmulq_f32(vminq_f32(ax, ay), a);
+#endif
+  z = vbslq_f32(vcgtq_f32(mx, zero), z, zero);
+  a = vmlaq_f32(vdupq_n_f32(0.2447f), vdupq_n_f32(0.0663f), z);
+  a = vmulq_f32(z, vmlsq_f32(vdupq_n_f32(PI_4_F), vsubq_f32(z, vdupq_n_f32(1.f)), a));
+  a = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32(PI_2_F), a), a);
+  a = vbslq_f32(vcltq_f32(x, zero), vsubq_f32(vdupq_n_f32(PI_F), a), a);
+
+  return vbslq_f32(vcltq_f32(y, zero), vnegq_f32(a), a);
+}
+
+static void polar_disc_fast_neon(const float *in, float *ob, int n, float *p)
+{
+  int i;
+  float32x4x2_t c, q;
+
+  if (n < 5)
+  {
+    polar_disc_fast_c(in, ob, n, p);
+    return;
+  }
+  polar_disc_fast_c(in, ob, 1, p);
+
+  for (i = 1; i + 4 <= n; i += 4)
+  {
+    c = vld2q_f32(in + 2 * i);
+    q = vld2q_f32(in + 2 * i - 2);
+    vst1q_f32(ob + i, atan2_fast_neon(vmlsq_f32(vmulq_f32(q.val[0], c.val[1]), q.val[1], c.val[0]),
+        vmlaq_f32(vmulq_f32(c.val[0], q.val[0]), c.val[1], q.val[1])));
+  }
+
+  p[0] = in[2 * i - 2];
+  p[1] = in[2 * i - 1];
+  polar_disc_fast_c(in + 2 * i, ob + i, n - i, p);
+}
+#endif
+
+/* kernels selected by init_simd() */
+static void (*rotate_90_u8_f32_kernel)(const uint8_t *in, float *ob, uint32_t len) = rotate_90_u8_f32_c;
+static void (*u8_f32_kernel)(const uint8_t *in, float *ob, uint32_t len) = u8_f32_c;
+static void (*decimate_cf32_kernel)(const float *x, const float *c, int n, int step, int nout, float *y) = decimate_cf32_c;
+static void (*pfb_fold_cf32_kernel)(const float *x, const float *c, int n, int m, float *acc) = pfb_fold_cf32_c;
+static void (*pfb_ifft_kernel)(const float *tw, int n, float (*xr)[PFB_LANES], float (*xj)[PFB_LANES]) = pfb_ifft_c;
+static void (*polar_disc_fast_kernel)(const float *in, float *ob, int n, float *p) = polar_disc_fast_c;
+
+const char *init_simd(int enable)
+{
+  const char *name = "scalar";
+
+  rotate_90_u8_f32_kernel = rotate_90_u8_f32_c;
+  u8_f32_kernel = u8_f32_c;
+  decimate_cf32_kernel = decimate_cf32_c;
+  pfb_fold_cf32_kernel = pfb_fold_cf32_c;
+  pfb_ifft_kernel = pfb_ifft_c;
+  polar_disc_fast_kernel = polar_disc_fast_c;
+
+  if (enable)
+  {
+#ifdef USE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+      name = "SSE2";
+      rotate_90_u8_f32_kernel = rotate_90_u8_f32_sse2;
+      u8_f32_kernel = u8_f32_sse2;
+      decimate_cf32_kernel = decimate_cf32_sse2;
+      pfb_fold_cf32_kernel = pfb_fold_cf32_sse2;
+      pfb_ifft_kernel = pfb_ifft_sse2;
+      polar_disc_fast_kernel = polar_disc_fast_sse2;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+      name = "AVX2";
+      rotate_90_u8_f32_kernel = rotate_90_u8_f32_avx2;
+      u8_f32_kernel = u8_f32_avx2;
+      decimate_cf32_kernel = decimate_cf32_avx2;
+      pfb_fold_cf32_kernel = pfb_fold_cf32_avx2;
+      pfb_ifft_kernel = pfb_ifft_avx2;
+      polar_disc_fast_kernel = polar_disc_fast_avx2;
+    }
+#endif
+#ifdef USE_SIMD_NEON
+    name = "NEON";
+    rotate_90_u8_f32_kernel = rotate_90_u8_f32_neon;
+    u8_f32_kernel = u8_f32_neon;
+    decimate_cf32_kernel = decimate_cf32_neon;
+    pfb_fold_cf32_kernel = pfb_fold_cf32_neon;
+    pfb_ifft_kernel = pfb_ifft_neon;
+    polar_disc_fast_kernel = polar_disc_fast_neon;
+#endif
+  }
+
+  return name;
+}
+
+void *dsp_alloc(size_t size)
+{
+  void *p;
+
+#ifdef _WIN32
+  p = _aligned_malloc(size, DSP_ALIGN);
+#else
+  if (posix_memalign(&p, DSP_ALIGN, size) != 0)
+    p = NULL;
+#endif
+  if (p)
+    memset(p, 0, size);
+  return p;
+}
+
+void dsp_free(void *p)
+{
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+/* a plane of n elements of size bytes at *pos, rounded up to DSP_ALIGN */
+static void *arena_plane(char *base, size_t *pos, size_t n, size_t size)
+{
+  void *p = base ? base + *pos : NULL;
+
+  *pos += (n * size + DSP_ALIGN - 1) & ~(size_t) (DSP_ALIGN - 1);
+  return p;
+}
+
+/* lowpassed holds the decimator output of one block, work the larger
+ of that and the audio made of it, result the audio as S16 */
+int init_demod_arena(struct demod_state *d, int block, int copy)
+{
+  size_t pos = 0;
+  long long nfm, audio;
+  char *base = NULL;
+  int pass;
+
+  if (d->channelized)
+    nfm = block / (2 * (int) sizeof(float));
+  else
+    nfm = (block / 2 + d->lp_taps) / d->downsample + 1;
+
+  /* every call of the resampler may round up once */
+  if (d->rate_out2 > 0)
+    audio = 2 * (nfm * d->rate_out2 / d->rate_in + nfm / LP_REAL_BLOCK + 16);
+  else
+    audio = nfm;
+
+  d->buf_size = copy ? (uint32_t) block : 0;
+  d->lowpassed_size = (int) (2 * nfm);
+  d->work_size = (int) ((audio > nfm) ? audio : nfm);
+  d->result_size = (int) audio;
+
+  /* measure, then carve */
+  for (pass = 0; pass < 2; pass++)
+  {
+    pos = 0;
+    d->buf_copy = arena_plane(base, &pos, d->buf_size, 1);
+    d->lowpassed = arena_plane(base, &pos, d->lowpassed_size, sizeof(float));
+    d->work = arena_plane(base, &pos, d->work_size, sizeof(float));
+    d->result = arena_plane(base, &pos, d->result_size, sizeof(int16_t));
+    if (pass == 0 && !(base = d->arena = dsp_alloc(pos)))
+      return -1;
+  }
+
+  return 0;
+}
+
+void deinit_demod_arena(struct demod_state *d)
+{
+  dsp_free(d->arena);
+  d->arena = NULL;
+  d->buf_copy = NULL;
+  d->lowpassed = NULL;
+  d->work = NULL;
+  d->result = NULL;
+}
+
+/* hamming windowed sinc low pass, cut off at half of the output rate */
+int init_decimator_f32(struct decimator_f32 *f, int factor, int taps, int max_input)
+{
+  int i;
+  float j, h;
+
+  f->factor = factor;
+  f->taps = taps;
+  f->coef_len = (2 * taps + 15) & ~15;
+  f->coef = dsp_alloc(f->coef_len * sizeof(float));
+  /* slack for the zero padded coefficients reading past the last window */
+  f->line_size = max_input + 2 * (taps + factor);
+  f->line = dsp_alloc((f->line_size + 16) * sizeof(float));
+  f->line_len = 0;
+  f->pos = 0;
+  if (!f->coef || !f->line)
+    return -1;
+
+  for (i = 0; i < taps; i++)
+  {
+    j = (float) i - (float) (taps - 1) / 2.0f;
+    h = (j == 0) ? 1.0f / (float) factor : sinf(PI_F * j / (float) factor) / (PI_F * j);
+    h *= 0.54f - 0.46f * cosf(PI2_F * (float) i / (float) (taps - 1));
+    f->coef[2 * (taps - 1 - i)] = h;
+    f->coef[2 * (taps - 1 - i) + 1] = h;
+  }
+
+  return 0;
+}
+
+void deinit_decimator_f32(struct decimator_f32 *f)
+{
+  dsp_free(f->coef);
+  dsp_free(f->line);
+  f->coef = NULL;
+  f->line = NULL;
+}
+
+/* where the next input block has to be written */
+static float *decimator_input(struct decimator_f32 *f)
+{
+  return f->line + f->line_len;
+}
+
+/* len floats were written at decimator_input() */
+static void decimator_push(struct decimator_f32 *f, int len)
+{
+  f->line_len += len;
+}
+
+/* filter up to max_out IQ outputs into ob, returns the number of
+ output floats, 0 once the line has no complete window left */
+int decimate_f32(struct decimator_f32 *f, float *ob, int max_out)
+{
+  int step = 2 * f->factor, nout;
+
+  if (f->line_len - f->pos < 2 * f->taps)
+    return 0;
+
+  nout = (f->line_len - f->pos - 2 * f->taps) / step + 1;
+  if (nout > max_out) nout = max_out;
+  decimate_cf32_kernel(f->line + f->pos, f->coef, f->coef_len, step, nout, ob);
+  f->pos += nout * step;
+
+  return nout * 2;
+}
+
+/* keep what the next windows still need */
+static void decimator_compact(struct decimator_f32 *f)
+{
+  f->line_len -= f->pos;
+  memmove(f->line, f->line + f->pos, f->line_len * sizeof(float));
+  f->pos = 0;
+}
+
+void lp_f32(struct demod_state *d)
+{
+  decimator_push(&d->decim, d->lp_len);
+  d->lp_len = decimate_f32(&d->decim, d->lowpassed, d->lowpassed_size >> 1);
+  decimator_compact(&d->decim);
+}
+
+/* input is converted straight into the delay line of the decimator,
+ lowpassed only ever holds the filtered and downsampled signal */
+void rotate_90_u8_f32(struct demod_state *d)
+{
+  rotate_90_u8_f32_kernel(d->buf, decimator_input(&d->decim), d->buf_len);
+  d->lp_len = d->buf_len;
+}
+
+void u8_f32(struct demod_state *d)
+{
+  u8_f32_kernel(d->buf, decimator_input(&d->decim), d->buf_len);
+  d->lp_len = d->buf_len;
+}
+
+/* moves the input down by shift Hz, the station lands on DC */
+void init_mixer_f32(struct mixer_f32 *m, int shift, int rate)
+{
+  double w = -6.283185307179586 * (double) shift / (double) rate;
+  int k;
+
+  for (k = 0; k <= MIXER_TILE; k++)
+  {
+    m->tab[2 * k] = (float) cos(w * k);
+    m->tab[2 * k + 1] = (float) sin(w * k);
+  }
+  m->ph_r = 1.0f;
+  m->ph_j = 0.0f;
+}
+
+/* multiplies len floats of IQ by the phasor, in place */
+void mix_f32(struct mixer_f32 *m, float *iq, int len)
+{
+  const float *tab = m->tab;
+  float pr, pj, cr, cj, xr, xj, g;
+  int i, k, n;
+
+  for (i = 0; i < len; i += n)
+  {
+    n = len - i;
+    if (n > 2 * MIXER_TILE) n = 2 * MIXER_TILE;
+    pr = m->ph_r;
+    pj = m->ph_j;
+    for (k = 0; k < n; k += 2)
+    {
+      cr = tab[k] * pr - tab[k + 1] * pj;
+      cj = tab[k] * pj + tab[k + 1] * pr;
+      xr = iq[i + k];
+      xj = iq[i + k + 1];
+      iq[i + k] = xr * cr - xj * cj;
+      iq[i + k + 1] = xr * cj + xj * cr;
+    }
+    /* step to the next tile, one Newton step keeps |ph| at 1 */
+    cr = tab[n] * pr - tab[n + 1] * pj;
+    cj = tab[n] * pj + tab[n + 1] * pr;
+    g = 1.5f - 0.5f * (cr * cr + cj * cj);
+    m->ph_r = cr * g;
+    m->ph_j = cj * g;
+  }
+}
+
+/* u8_f32 followed by the mixer, in place in the decimator line */
+void mix_u8_f32(struct demod_state *d)
+{
+  float *ob = decimator_input(&d->decim);
+
+  u8_f32_kernel(d->buf, ob, d->buf_len);
+  mix_f32(&d->mix, ob, (int) d->buf_len);
+  d->lp_len = d->buf_len;
+}
+
+/* the bank uses the decimator low pass as prototype, nch * taps long,
+ so every channel is cut off at half of its output rate */
+int init_pfb_f32(struct pfb_f32 *p, int nch, int factor, int taps, int max_input)
+{
+  int i, j, b, len = nch * taps;
+  float x, h;
+
+  if (nch < 4 || nch > PFB_MAX_CHANNELS || (nch & (nch - 1)) || factor > nch)
+    return -1;
+
+  p->nch = nch;
+  p->factor = factor;
+  p->taps = taps;
+  p->coef = dsp_alloc(2 * len * sizeof(float));
+  p->line_size = max_input + 4 * len + 2 * factor;
+  p->line = dsp_alloc(p->line_size * sizeof(float));
+  p->line_len = 0;
+  p->pos = 0;
+  p->phase = 0;
+  if (!p->coef || !p->line)
+    return -1;
+
+  for (i = 0; i < len; i++)
+  {
+    x = (float) i - (float) (len - 1) / 2.0f;
+    h = (x == 0) ? 1.0f / (float) factor : sinf(PI_F * x / (float) factor) / (PI_F * x);
+    h *= 0.54f - 0.46f * cosf(PI2_F * (float) i / (float) (len - 1));
+    p->coef[2 * (len - 1 - i)] = h;
+    p->coef[2 * (len - 1 - i) + 1] = h;
+  }
+
+  for (i = 0; i < nch; i++)
+  {
+    p->tw[2 * i] = (float) cos(6.283185307179586 * i / nch);
+    p->tw[2 * i + 1] = (float) sin(6.283185307179586 * i / nch);
+    for (j = 1, b = 0; j < nch; j <<= 1)
+      b = (b << 1) | ((i & j) ? 1 : 0);
+    p->rev[i] = b;
+  }
+
+  return 0;
+}
+
+void deinit_pfb_f32(struct pfb_f32 *p)
+{
+  dsp_free(p->coef);
+  dsp_free(p->line);
+  p->coef = NULL;
+  p->line = NULL;
+}
+
+/* keeps what the next windows still need and appends len bytes of u8
+ IQ, pfb_f32 has to be called until it returns 0 before the next block */
+void pfb_u8(struct pfb_f32 *p, const uint8_t *buf, int len)
+{
+  p->line_len -= p->pos;
+  memmove(p->line, p->line + p->pos, p->line_len * sizeof(float));
+  p->pos = 0;
+
+  u8_f32_kernel(buf, p->line + p->line_len, len);
+  p->line_len += len;
+}
+
+/* up to max_out IQ samples of the channels in bins, channel k is the
+ one at k * rate / nch (k >= nch / 2 below the center). for every
+ output the window is folded into nch branch sums, one FFT turns them
+ into all the channels and the phase of the mixer that isn't there is
+ put back with e^-j2pi k n / M. returns the samples written to each ob */
+int pfb_f32(struct pfb_f32 *p, const int *bins, int nbins, float **ob, int max_out)
+{
+  float acc[2 * PFB_MAX_CHANNELS];
+  float xr[PFB_MAX_CHANNELS][PFB_LANES], xj[PFB_MAX_CHANNELS][PFB_LANES];
+  int m2 = 2 * p->nch, len = m2 * p->taps, mask = p->nch - 1;
+  int i, j, k, l, r, nl, o = 0;
+
+  while (o < max_out && p->line_len - p->pos >= len)
+  {
+    /* PFB_LANES outputs at a time, or what is left */
+    nl = (p->line_len - p->pos - len) / (2 * p->factor) + 1;
+    if (nl > PFB_LANES) nl = PFB_LANES;
+    if (nl > max_out - o) nl = max_out - o;
+
+    for (l = 0; l < PFB_LANES; l++)
+    {
+      if (l < nl)
+        pfb_fold_cf32_kernel(p->line + p->pos + l * 2 * p->factor, p->coef, len, m2, acc);
+      else
+        memset(acc, 0, m2 * sizeof(float));
+      /* the newest sample sits in branch 0, reverse the branches while
+       putting them in bit reversed order */
+      for (j = 0; j < p->nch; j++)
+      {
+        xr[p->rev[j]][l] = acc[m2 - 2 - 2 * j];
+        xj[p->rev[j]][l] = acc[m2 - 1 - 2 * j];
+      }
+    }
+    pfb_ifft_kernel(p->tw, p->nch, xr, xj);
+
+    for (l = 0; l < nl; l++)
+    {
+      for (i = 0; i < nbins; i++)
+      {
+        k = bins[i];
+        r = 2 * ((k * p->phase) & mask);
+        ob[i][2 * (o + l)] = xr[k][l] * p->tw[r] + xj[k][l] * p->tw[r + 1];
+        ob[i][2 * (o + l) + 1] = xj[k][l] * p->tw[r] - xr[k][l] * p->tw[r + 1];
+      }
+      p->phase = (p->phase + p->factor) & mask;
+    }
+
+    p->pos += nl * 2 * p->factor;
+    o += nl;
+  }
+
+  return o;
+}
+
+/* second order loop of 30 Hz natural frequency, damping 0.707,
+ the lock detector is one pole of 1/240 s, about 4 ms, at any rate */
+void init_pilot_pll(struct pilot_pll *p, int rate)
+{
+  int i;
+  float wn = PI2_F * 30.0f * (float) PLL_UPDATE / (float) rate;
+
+  for (i = 0; i < PLL_TABLE_SIZE; i++)
+    pll_sin_table[i] = sinf(PI2_F * (float) i / (float) PLL_TABLE_SIZE);
+
+  p->phase = 0;
+  p->step = 19000.0f / (float) rate;
+  p->inc = (uint32_t) ((double) p->step * 4294967296.0);
+  p->integ = 0;
+  p->integ_max = (float) PLL_PULL * (float) PLL_UPDATE / (float) rate;
+  /* phase error in radians, NCO in cycles */
+  p->kp = 2.0f * 0.707f * wn / PI2_F;
+  p->ki = wn * wn / PI2_F;
+  p->lp = 0.005f * 48000.0f * (float) PLL_UPDATE / (float) rate;
+  p->in_phase = 0;
+  p->power = 0;
+  p->locked = 0;
+}
+
+/* track the band passed pilot and write the 38 kHz reference 2 sin(2 phase).
+ Between loop updates the NCO runs free, so the samples do not depend on
+ each other. The error is scaled by the pilot amplitude of the previous
+ call, the loop gain does not depend on the level */
+static void pilot_pll_f32(struct pilot_pll *p, const float *vp, float *ref, int n)
+{
+  int i, k, m;
+  uint32_t ph;
+  float norm, e, es, is, ps, s, c, d;
+
+  norm = (p->power > 1e-12f) ? sqrtf(2.0f / p->power) : 0.f;
+
+  for (k = 0; k < n; k += m, vp += m, ref += m)
+  {
+    m = (n - k < PLL_UPDATE) ? n - k : PLL_UPDATE;
+    es = is = ps = 0;
+
+    for (i = 0; i < m; i++)
+    {
+      ph = (p->phase + (uint32_t) i * p->inc) >> (32 - PLL_TABLE_BITS);
+      s = pll_sin_table[ph];
+      c = pll_sin_table[(ph + PLL_TABLE_SIZE / 4) & (PLL_TABLE_SIZE - 1)];
+      /* L-R * sin^2 averages to (L-R) / 2 */
+      ref[i] = 2.0f * pll_sin_table[(2 * ph) & (PLL_TABLE_SIZE - 1)];
+
+      /* pilot * cos ~ sin(pilot phase - phase) * A / 2 */
+      es += vp[i] * c;
+      is += vp[i] * s;
+      ps += vp[i] * vp[i];
+    }
+    p->phase += (uint32_t) m * p->inc;
+
+    e = es * norm / (float) m;
+    /* a tiny power of the last call makes e huge, keep both in range of
+     the conversions */
+    p->integ += p->ki * e;
+    if (p->integ > p->integ_max)
+      p->integ = p->integ_max;
+    else if (p->integ < -p->integ_max)
+      p->integ = -p->integ_max;
+    p->inc = (uint32_t) ((double) (p->step + p->integ / (float) PLL_UPDATE) * 4294967296.0);
+    d = p->kp * e;
+    if (d > 0.5f)
+      d = 0.5f;
+    else if (d < -0.5f)
+      d = -0.5f;
+    p->phase += (uint32_t) (int64_t) (d * 4294967296.0f);
+
+    p->in_phase += p->lp * (is / (float) m - p->in_phase);
+    p->power += p->lp * (ps / (float) m - p->power);
+  }
+
+  /* in_phase^2 / power is 0.5 when locked, hysteresis against flapping */
+  if (p->locked)
+  {
+    if (p->in_phase <= 0.f || p->in_phase * p->in_phase < 0.15f * p->power)
+    {
+      /* pull in again from 19 kHz */
+      p->locked = 0;
+      p->integ = 0;
+      p->inc = (uint32_t) ((double) p->step * 4294967296.0);
+    }
+  }
+  else if (p->in_phase > 0.f && p->in_phase * p->in_phase > 0.3f * p->power)
+  {
+    p->locked = 1;
+  }
+}
+
+void init_pilot_detect(struct pilot_detect *d, int rate)
+{
+  int i;
+  const float f[3] = { 19000.0f, 17500.0f, 20500.0f };
+
+  for (i = 0; i < 3; i++)
+  {
+    d->coef[i] = 2.0f * cosf(PI2_F * f[i] / (float) rate);
+    d->s1[i] = d->s2[i] = 0;
+  }
+  d->count = 0;
+  d->hits = 0;
+  d->present = 0;
+}
+
+/* pilot present once it stands 10 dB over the floor for PILOT_HITS
+ windows, gone once it drops under 5 dB for as long */
+static void pilot_detect_f32(struct pilot_detect *d, const float *x, int n)
+{
+  int i, k;
+  float s, p[3];
+
+  for (i = 0; i < n; i++)
+  {
+    for (k = 0; k < 3; k++)
+    {
+      s = x[i] + d->coef[k] * d->s1[k] - d->s2[k];
+      d->s2[k] = d->s1[k];
+      d->s1[k] = s;
+    }
+
+    if (++d->count < PILOT_WINDOW)
+      continue;
+
+    for (k = 0; k < 3; k++)
+    {
+      p[k] = d->s1[k] * d->s1[k] + d->s2[k] * d->s2[k] - d->coef[k] * d->s1[k] * d->s2[k];
+      d->s1[k] = d->s2[k] = 0;
+    }
+    d->count = 0;
+
+    /* p[0] > 10 or 3 times the mean of the neighbours */
+    if (d->present ? (p[0] * 2.0f < 3.0f * (p[1] + p[2]) || p[0] <= 0.f)
+                   : (p[0] * 2.0f > 10.0f * (p[1] + p[2]) && p[0] > 0.f))
+    {
+      if (++d->hits >= PILOT_HITS)
+      {
+        d->present = !d->present;
+        d->hits = 0;
+      }
+    }
+    else
+    {
+      d->hits = 0;
+    }
+  }
+}
+
+static int gcd(int a, int b)
+{
+  int t;
+
+  while (b)
+  {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* hamming windowed sinc prototype of up * taps at up times the input
+ rate, split into up phase banks, gain up for the zero stuffing */
+int init_resampler_f32(struct resampler_f32 *r, int rate_in, int rate_out, int taps, int channels, float cutoff)
+{
+  int g, c, i, k, p, n, len;
+  float fc, fi, fv, fh;
+
+  g = gcd(rate_in, rate_out);
+  r->up = rate_out / g;
+  r->down = rate_in / g;
+  r->taps = taps;
+  r->channels = channels;
+  r->coef = NULL;
+  if (r->up > RESAMPLER_MAX_PHASES)
+    return -1;
+
+  r->coef_len = (channels * taps + 15) & ~15;
+  r->coef = dsp_alloc(r->up * r->coef_len * sizeof(float));
+  if (!r->coef)
+    return -1;
+  /* outputs of integer downsampling land where the old tick based
+   decimation put them */
+  r->acc = (r->down > r->up) ? r->down - r->up : 0;
+
+  n = r->up * taps;
+  fc = cutoff / ((float) rate_in * (float) r->up);
+  for (i = 0; i < n; i++)
+  {
+    fi = (float) i - (float) (n - 1) / 2.0f;
+    fh = 0.54f - 0.46f * cosf(PI2_F * (float) i / (float) (n - 1));
+    fv = (fi == 0) ? 2.0f * fc : sinf(PI2_F * fc * fi) / (PI_F * fi);
+    /* tap i = p + k * up belongs to phase p and is applied to the
+     input k samples before the newest, the line runs oldest first */
+    p = i % r->up;
+    k = i / r->up;
+    len = taps - 1 - k;
+    for (c = 0; c < channels; c++)
+      r->coef[p * r->coef_len + len * channels + c] = fv * fh * (float) r->up;
+  }
+
+  return 0;
+}
+
+void deinit_resampler_f32(struct resampler_f32 *r)
+{
+  dsp_free(r->coef);
+  r->coef = NULL;
+}
+
+/* outputs for n new samples of a line holding taps - 1 samples of
+ history in front, returns the number of floats written to ob */
+int resample_f32(struct resampler_f32 *r, const float *line, int n, float *ob, int ob_size)
+{
+  int o = 0, k, p, end = n * r->up;
+  float v[2];
+
+  while (r->acc < end && o + r->channels <= ob_size)
+  {
+    k = r->acc / r->up;
+    p = r->acc - k * r->up;
+    decimate_cf32_kernel(line + k * r->channels, r->coef + p * r->coef_len, r->coef_len, 0, 1, v);
+    if (r->channels == 2)
+    {
+      ob[o++] = v[0];
+      ob[o++] = v[1];
+    }
+    else
+    {
+      /* real line, even and odd taps came out as a pair */
+      ob[o++] = v[0] + v[1];
+    }
+    r->acc += r->down;
+  }
+  r->acc -= end;
+
+  return o;
+}
+
+int init_lp_real_f32(struct demod_state *fm)
+{
+  int i, n;
+  float fmh, fpl, fph, fsl, fsh, fv, fi, fh, fc;
+
+  fm->lpr.rsize = (fm->lpr.size >> 1);
+  init_pilot_pll(&fm->lpr.pll, fm->rate_in);
+  init_pilot_detect(&fm->lpr.pd, fm->rate_in);
+  fmh = 16000.0f / (float) fm->rate_in;
+  fpl = 18000.0f / (float) fm->rate_in;
+  fph = 20000.0f / (float) fm->rate_in;
+  fsl = 21000.0f / (float) fm->rate_in;
+  fsh = 55000.0f / (float) fm->rate_in;
+  /* delay lines keep size - 1 samples of history in front of the block */
+  n = fm->lpr.size - 1 + LP_REAL_BLOCK;
+  fm->lpr.br = dsp_alloc((n + 16) * 4);
+  /* L+R and L-R interleaved, slack for the padded coefficients */
+  fm->lpr.bms = dsp_alloc((2 * n + 16) * 4);
+  fm->lpr.ob_size = fm->work_size;
+  fm->lpr.ob = dsp_alloc(fm->lpr.ob_size * 4);
+  /* filters are symetrical, so only half size */
+  fm->lpr.fm = dsp_alloc((fm->lpr.size >> 1) * 4);
+  fm->lpr.fp = dsp_alloc((fm->lpr.size >> 1) * 4);
+  fm->lpr.fs = dsp_alloc((fm->lpr.size >> 1) * 4);
+  for (i = 0; i < fm->lpr.rsize; i++)
+  {
+    fi = (float) i - (float) (fm->lpr.size - 1) / 2.0f;
+    /* hamming window */
+    fh = 0.54f - 0.46f * cosf(PI2_F * (float) i / (float) (fm->lpr.size - 1));
+    /* low pass */
+    fv = (fi == 0) ? 2.0f * fmh : sinf(PI2_F * fmh * fi) / (PI_F * fi);
+    fm->lpr.fm[i] = fv * fh;
+    /* pilot band pass */
+    fv = (fi == 0) ? 2.0f * (fph - fpl) : (sinf(PI2_F * fph * fi) - sinf(PI2_F * fpl * fi)) / (PI_F * fi);
+    fm->lpr.fp[i] = fv * fh;
+    /* stereo band pass */
+    fv = (fi == 0) ? 2.0f * (fsh - fsl) : (sinf(PI2_F * fsh * fi) - sinf(PI2_F * fsl * fi)) / (PI_F * fi);
+    fm->lpr.fs[i] = fv * fh;
+  }
+
+  /* audio low pass (0 Hz ... 17 kHz) and resampling to rate_out2 in one,
+   lowered for output rates that can not carry 16 kHz, minus half the
+   transition band of the window */
+  fc = 0.5f * (float) fm->rate_out2 - 1.65f * (float) fm->rate_in / (float) fm->lpr.size;
+  if (fc > 16000.0f) fc = 16000.0f;
+  if (!fm->lpr.br || !fm->lpr.bms || !fm->lpr.ob || !fm->lpr.fm || !fm->lpr.fp || !fm->lpr.fs)
+    return -1;
+  fm->lpr.rs_mono.coef = NULL;
+  if (fm->lpr.mode == 2 && init_resampler_f32(&fm->lpr.rs_mono, fm->rate_in, fm->rate_out2, fm->lpr.size, 1, fc) < 0)
+    return -1;
+  return init_resampler_f32(&fm->lpr.rs, fm->rate_in, fm->rate_out2, fm->lpr.size,
+      (fm->lpr.mode == 2) ? 2 : 1, fc);
+}
+
+void deinit_lp_real_f32(struct demod_state *fm)
+{
+  fm->lpr.rsize = 0;
+  dsp_free(fm->lpr.br);
+  dsp_free(fm->lpr.bms);
+  dsp_free(fm->lpr.ob);
+  dsp_free(fm->lpr.fm);
+  dsp_free(fm->lpr.fp);
+  dsp_free(fm->lpr.fs);
+  deinit_resampler_f32(&fm->lpr.rs);
+  deinit_resampler_f32(&fm->lpr.rs_mono);
+  fm->lpr.br = NULL;
+  fm->lpr.bms = NULL;
+  fm->lpr.ob = NULL;
+  fm->lpr.fm = NULL;
+  fm->lpr.fp = NULL;
+  fm->lpr.fs = NULL;
+}
+
+/* the three filters of the stereo decoder over m samples, the windows
+ start at br[0] and are size long, tap pairs meet in the middle of the
+ symmetric filters. Taps outside, samples inside, so the loops run over
+ contiguous memory and get vectorized. vs is left alone if !locked */
+static void stereo_fir_f32(const struct lp_real *lpr, const float *br, float *vm, float *vp, float *vs, int m, int locked)
+{
+  float v;
+  int i, k;
+
+  for (i = 0; i < m; i++)
+    vm[i] = vp[i] = 0;
+  if (locked)
+  {
+    for (i = 0; i < m; i++)
+      vs[i] = 0;
+  }
+
+  for (k = 0; k < lpr->rsize; k++)
+  {
+    const float *a = br + k, *b = br + lpr->size - 1 - k;
+    float hm = lpr->fm[k], hp = lpr->fp[k], hs = lpr->fs[k];
+
+    if (locked)
+    {
+      for (i = 0; i < m; i++)
+      {
+        v = a[i] + b[i];
+        vm[i] += v * hm; /* L+R low pass (0 Hz ... 17 kHz) */
+        vp[i] += v * hp; /* Pilot frequency band pass (18 kHz ... 20 kHz) --> filters out the 19 kHz */
+        vs[i] += v * hs; /* L-R band pass (21 kHz ... 55 kHz) */
+      }
+    }
+    else
+    {
+      for (i = 0; i < m; i++)
+      {
+        v = a[i] + b[i];
+        vm[i] += v * hm;
+        vp[i] += v * hp;
+      }
+    }
+  }
+}
+
+/* L+R and L-R of n samples, the windows start at br[0]. With fir the
+ filters were already run by a demod_job, L+R, pilot and L-R are read
+ from there, stride floats apart. L-R only if the job saw the lock,
+ tiles that have it since are filtered here */
+static void stereo_split_f32(struct lp_real *lpr, const float *br, float *bms, int n, const float *fir, int stride, int fir_locked)
+{
+  float tm[LP_REAL_TILE], tp[LP_REAL_TILE], ts[LP_REAL_TILE], ref[LP_REAL_TILE];
+  const float *vm, *vp, *vs;
+  int i, t, locked;
+
+  for (t = 0; t < n; t += LP_REAL_TILE, br += LP_REAL_TILE, bms += 2 * LP_REAL_TILE)
+  {
+    int m = (n - t < LP_REAL_TILE) ? n - t : LP_REAL_TILE;
+
+    /* without pilot lock the whole L-R path is skipped */
+    locked = lpr->pll.locked;
+
+    if (fir && (fir_locked || !locked))
+    {
+      vm = fir + t;
+      vp = fir + stride + t;
+      vs = fir + 2 * stride + t;
+    }
+    else
+    {
+      stereo_fir_f32(lpr, br, tm, tp, ts, m, locked);
+      vm = tm;
+      vp = tp;
+      vs = ts;
+    }
+
+    /* AM L-R demodulation with the PLL doubled pilot 19 kHz --> 38 kHz */
+    pilot_pll_f32(&lpr->pll, vp, ref, m);
+    if (locked)
+    {
+      for (i = 0; i < m; i++)
+      {
+        bms[2 * i] = vm[i];
+        bms[2 * i + 1] = vs[i] * ref[i];
+      }
+    }
+    else
+    {
+      for (i = 0; i < m; i++)
+      {
+        bms[2 * i] = vm[i];
+        bms[2 * i + 1] = 0;
+      }
+    }
+  }
+}
+
+/* audio low pass and resampling of len FM samples into ob, fir are
+ the stereo filters of them if a demod_job has run them.
+ returns the number of floats written */
+static int lp_real_run(struct demod_state *fm, const float *ib, const float *fir, int stride, int fir_locked, int len, float *ob, int ob_size)
+{
+  int i, k, n, t, present, o = 0, fast = (int) fm->rate_out, slow = (int) fm->rate_out2;
+  int hist = fm->lpr.size - 1;
+  float v, *br = fm->lpr.br, *bms = fm->lpr.bms;
+
+  if (fm->lpr.mode == 0)
+  {
+    for (i = 0; i < len && o < ob_size; i++)
+    {
+      if ((fm->prev_lpr_index += slow) >= fast)
+      {
+        fm->prev_lpr_index -= fast;
+        ob[o++] = ib[i];
+      }
+    }
+    return o;
+  }
+
+  /* blocks go behind the history */
+  for (t = 0; t < len; t += n)
+  {
+    n = len - t;
+    if (n > LP_REAL_BLOCK) n = LP_REAL_BLOCK;
+    memcpy(br + hist, ib + t, n * sizeof(float));
+
+    if (fm->lpr.mode == 1) /* Mono */
+    {
+      o += resample_f32(&fm->lpr.rs, br, n, ob + o, ob_size - o);
+    }
+    else /* Stereo */
+    {
+      present = fm->lpr.pd.present;
+      pilot_detect_f32(&fm->lpr.pd, br + hist, n);
+      if (present != fm->lpr.pd.present)
+      {
+        fm->lpr.pll.locked = 0;
+        if (fm->lpr.pd.present)
+        {
+          /* L+R restarts from the plain signal, the resampler low pass
+           removes the pilot and the subcarrier from it */
+          for (i = 0; i < hist; i++)
+          {
+            bms[2 * i] = br[i];
+            bms[2 * i + 1] = 0;
+          }
+          fm->lpr.rs.acc = fm->lpr.rs_mono.acc;
+        }
+        else
+        {
+          fm->lpr.rs_mono.acc = fm->lpr.rs.acc;
+        }
+      }
+
+      if (fm->lpr.pd.present)
+      {
+        stereo_split_f32(&fm->lpr, br, bms + 2 * hist, n, fir ? fir + t : NULL, stride, fir_locked);
+
+        /* low pass (0 Hz ... 17 kHz) of L+R and L-R at the output rate,
+         removes unwanted AM demodulation high frequencies */
+        o += resample_f32(&fm->lpr.rs, bms, n, ob + o, ob_size - o);
+        memmove(bms, bms + 2 * n, 2 * hist * sizeof(float));
+      }
+      else
+      {
+        /* no pilot, mono path but still stereo frames with L-R = 0 */
+        k = resample_f32(&fm->lpr.rs_mono, br, n, ob + o, (ob_size - o) / 2);
+        for (i = k - 1; i >= 0; i--)
+        {
+          ob[o + 2 * i] = ob[o + i];
+          ob[o + 2 * i + 1] = 0;
+        }
+        o += 2 * k;
+      }
+    }
+    memmove(br, br + n, hist * sizeof(float));
+  }
+
+  if (fm->lpr.mode == 2)
+  {
+    /* Calculate stereo signal */
+    for (i = 0; i < o; i += 2)
+    {
+      v = ob[i];
+      ob[i] = v + ob[i + 1];
+      ob[i + 1] = v - ob[i + 1];
+    }
+  }
+
+  return o;
+}
+
+int lp_real_block(struct demod_state *fm, const float *ib, int len, float *ob, int ob_size)
+{
+  return lp_real_run(fm, ib, NULL, 0, 0, len, ob, ob_size);
+}
+
+/* the resampler may produce more than it reads, so through lpr.ob */
+void lp_real_f32(struct demod_state *fm)
+{
+  fm->result_len = lp_real_block(fm, fm->work, fm->result_len, fm->lpr.ob, fm->lpr.ob_size);
+  memcpy(fm->work, fm->lpr.ob, fm->result_len * sizeof(float));
+}
+
+static void polar_disc(int custom_atan, const float *ib, float *ob, int n, float *p)
+{
+  switch (custom_atan)
+  {
+  case ATAN_STD:
+    polar_disc_std(ib, ob, n, p);
+    break;
+  case ATAN_LUT:
+    polar_disc_lut(ib, ob, n, p);
+    break;
+  default:
+    /* atanf function needs more computer power, better is to use approximation */
+    polar_disc_fast_kernel(ib, ob, n, p);
+    break;
+  }
+}
+
+/* absolute error < 0.0015, computation error: 0.012%, mono: 0.010, stereo: 0.007% */
+void fm_demod_block(struct demod_state *fm, const float *ib, float *ob, int n)
+{
+  float p[2];
+
+  p[0] = fm->pre_r_f32;
+  p[1] = fm->pre_j_f32;
+
+  polar_disc(fm->custom_atan, ib, ob, n, p);
+
+  fm->pre_r_f32 = p[0];
+  fm->pre_j_f32 = p[1];
+}
+
+void fm_demod_f32(struct demod_state *fm)
+{
+  fm->result_len = fm->lp_len >> 1;
+  fm_demod_block(fm, fm->lowpassed, fm->work, fm->result_len);
+}
+
+void deemph_block(struct demod_state *fm, float *ib, int n)
+{
+  int i;
+
+  if (fm->lpr.mode == 2)
+  {
+    for (i = 0; i < n; i += 2)
+    {
+      /* left */
+      fm->deemph_l_f32 = (ib[i] += fm->deemph_lambda * (fm->deemph_l_f32 - ib[i]));
+      /* right */
+      fm->deemph_r_f32 = (ib[i + 1] += fm->deemph_lambda * (fm->deemph_r_f32 - ib[i + 1]));
+    }
+  }
+  else
+  {
+    for (i = 0; i < n; i++)
+    {
+      fm->deemph_l_f32 = (ib[i] += fm->deemph_lambda * (fm->deemph_l_f32 - ib[i]));
+    }
+  }
+}
+
+void deemph_filter_f32(struct demod_state *fm)
+{
+  deemph_block(fm, fm->work, fm->result_len);
+}
+
+/* ob may be the same memory as ib, int16 i never lands on a float
+ that has not been read yet */
+void convert_block(struct demod_state *fm, const float *ib, int16_t *ob, int n)
+{
+  int i;
+  float v, coef;
+
+  coef = fm->volume * 32768.0f;
+
+  for (i = 0; i < n; i++)
+  {
+    v = ib[i] * coef;
+    if (v > 32767.0f)
+    {
+      ob[i] = 32767;
+    }
+    else if (v < -32768.0f)
+    {
+      ob[i] = -32768;
+    }
+    else
+    {
+      ob[i] = (int16_t) lrintf(v);
+    }
+  }
+}
+
+void convert_f32_s16(struct demod_state *fm)
+{
+  convert_block(fm, fm->work, fm->result, fm->result_len);
+}
+
+int rms(int16_t *samples, int len, int step)
+/* largely lifted from rtl_power */
+{
+  int i;
+  long p, t, s;
+  double dc, err;
+
+  p = t = 0L;
+  for (i=0; i<len; i+=step) {
+    s = (long)samples[i];
+    t += s;
+    p += s * s;
+  }
+  /* correct for dc offset in squares */
+  dc = (double)(t*step) / (double)len;
+  err = t * 2 * dc - dc * dc * len;
+
+  return (int)sqrt((p-err) / len);
+}
+
+
+/* reference, every stage runs over the whole block */
+static void full_demod_multipass(struct demod_state *d)
+{
+  /* Low pass to filter only to the tuned FM channel */
+  if (!d->channelized)
+    lp_f32(d);
+
+  /* FM demodulation */
+  fm_demod_f32(d); /* lowpassed -> work */
+
+  /* todo, fm noise squelch */
+  
+  /* use nicer filter here too? */
+  if (d->post_downsample > 1)
+  {
+    /* For float not implemented */
+  }
+
+  if (d->rate_out2 > 0)
+    lp_real_f32(d);
+
+  if (d->deemph)
+    deemph_filter_f32(d);
+
+  convert_f32_s16(d);
+}
+
+/* n FM samples of a tile to S16 at result + o, returns the new o */
+static int demod_tile_audio(struct demod_state *d, const float *fm, const float *fir, int stride, int fir_locked, int n, int o)
+{
+  float au[DEMOD_TILE_AUDIO];
+  int m;
+
+  if (d->rate_out2 > 0)
+  {
+    m = lp_real_run(d, fm, fir, stride, fir_locked, n, au, DEMOD_TILE_AUDIO);
+  }
+  else
+  {
+    memcpy(au, fm, n * sizeof(float));
+    m = n;
+  }
+
+  if (d->deemph)
+    deemph_block(d, au, m);
+
+  if (m > d->result_size - o)
+    m = d->result_size - o;
+  convert_block(d, au, d->result + o, m);
+
+  return o + m;
+}
+
+/* the same stages on DEMOD_TILE samples at a time, from the decimator
+ to S16 every tile stays in L1 and result only receives the output.
+ channelized input is taken from lowpassed as it is */
+static void full_demod_fused(struct demod_state *d)
+{
+  float iq[2 * DEMOD_TILE], fm[DEMOD_TILE];
+  const float *ib;
+  int n, o = 0, pos = 0;
+
+  if (!d->channelized)
+    decimator_push(&d->decim, d->lp_len);
+
+  for (;;)
+  {
+    if (d->channelized)
+    {
+      n = (d->lp_len - pos) >> 1;
+      if (n > DEMOD_TILE) n = DEMOD_TILE;
+      ib = d->lowpassed + pos;
+      pos += 2 * n;
+    }
+    else
+    {
+      n = decimate_f32(&d->decim, iq, DEMOD_TILE) >> 1;
+      ib = iq;
+    }
+    if (n <= 0)
+      break;
+
+    fm_demod_block(d, ib, fm, n);
+    o = demod_tile_audio(d, fm, NULL, 0, 0, n, o);
+  }
+
+  if (!d->channelized)
+    decimator_compact(&d->decim);
+  d->result_len = o;
+}
+
+void full_demod(struct demod_state *d)
+{
+  if (d->multipass)
+    full_demod_multipass(d);
+  else
+    full_demod_fused(d);
+}
+
+/* a job per slot, the line of the decimator moves from job to job, the
+ first slot takes the one init_decimator_f32 allocated */
+int init_demod_jobs(struct demod_state *d, int n)
+{
+  struct demod_job *j;
+  int i, in, nmax;
+
+  if (d->channelized)
+  {
+    in = d->lowpassed_size;
+    nmax = in / 2;
+  }
+  else
+  {
+    in = d->decim.line_size + 16;
+    nmax = d->decim.line_size / (2 * d->decim.factor) + 1;
+  }
+
+  d->jobs = calloc(n, sizeof(struct demod_job));
+  if (!d->jobs)
+    return -1;
+  d->jobs_len = n;
+
+  for (i = 0; i < n; i++)
+  {
+    j = &d->jobs[i];
+    j->d = d;
+    j->nmax = nmax;
+    j->in = (i == 0 && !d->channelized) ? d->decim.line : dsp_alloc(in * sizeof(float));
+    j->fm = dsp_alloc(nmax * sizeof(float));
+    if (d->lpr.mode == 2 && d->rate_out2 > 0)
+      j->fir = dsp_alloc(3 * nmax * sizeof(float));
+    if (!j->in || !j->fm || (d->lpr.mode == 2 && d->rate_out2 > 0 && !j->fir))
+      return -1;
+  }
+
+  return 0;
+}
+
+void deinit_demod_jobs(struct demod_state *d)
+{
+  int i;
+
+  if (!d->jobs)
+    return;
+  for (i = 0; i < d->jobs_len; i++)
+  {
+    dsp_free(d->jobs[i].in);
+    dsp_free(d->jobs[i].fm);
+    dsp_free(d->jobs[i].fir);
+  }
+  free(d->jobs);
+  d->jobs = NULL;
+  d->jobs_len = 0;
+  /* it was one of them */
+  d->decim.line = NULL;
+}
+
+/* before the input is converted: the decimator line continues in the
+ buffer of j with what the next windows need, plus the window of the
+ last output so the job can rebuild the discriminator history */
+void demod_job_start(struct demod_state *d, struct demod_job *j)
+{
+  struct decimator_f32 *f = &d->decim;
+  int step = 2 * f->factor, keep, from;
+
+  if (d->channelized)
+    return;
+
+  keep = (f->pos >= step) ? step : 0;
+  from = f->pos - keep;
+  f->line_len -= from;
+  memmove(j->in, f->line + from, f->line_len * sizeof(float));
+  f->line = j->in;
+  f->pos = keep;
+}
+
+/* after the input is converted: the outputs of this block, the
+ decimator moves on as if it had filtered them */
+void demod_job_cut(struct demod_state *d, struct demod_job *j)
+{
+  struct decimator_f32 *f = &d->decim;
+  int step = 2 * f->factor;
+
+  j->done = 0;
+  /* the workers filter for what the decoder does now, lp_real_run
+   catches up on a change before the job is back */
+  j->present = d->lpr.pd.present;
+  j->locked = d->lpr.pll.locked;
+
+  if (d->channelized)
+  {
+    j->prev = 0;
+    j->pre[0] = d->pre_r_f32;
+    j->pre[1] = d->pre_j_f32;
+    j->nout = d->lp_len >> 1;
+    memcpy(j->in, d->lowpassed, d->lp_len * sizeof(float));
+    if (j->nout > 0)
+    {
+      d->pre_r_f32 = j->in[d->lp_len - 2];
+      d->pre_j_f32 = j->in[d->lp_len - 1];
+    }
+    return;
+  }
+
+  decimator_push(f, d->lp_len);
+  j->prev = (f->pos >= step);
+  j->pre[0] = d->pre_r_f32;
+  j->pre[1] = d->pre_j_f32;
+  j->nout = 0;
+  if (f->line_len - f->pos >= 2 * f->taps)
+    j->nout = (f->line_len - f->pos - 2 * f->taps) / step + 1;
+  f->pos += j->nout * step;
+}
+
+/* worker side, touches nothing but j and what d only reads. The
+ discriminator runs on the same tiles as full_demod_fused, the stereo
+ filters only where their window lies inside this block */
+void demod_job_run(struct demod_job *j)
+{
+  struct demod_state *d = j->d;
+  struct decimator_f32 *f = &d->decim;
+  float iq[2 * DEMOD_TILE], p[2];
+  const float *ib = j->in;
+  int t, n, step = 2 * f->factor, hist = d->lpr.size - 1;
+
+  p[0] = j->pre[0];
+  p[1] = j->pre[1];
+
+  if (d->channelized)
+  {
+    for (t = 0; t < j->nout; t += n)
+    {
+      n = (j->nout - t < DEMOD_TILE) ? j->nout - t : DEMOD_TILE;
+      polar_disc(d->custom_atan, ib + 2 * t, j->fm + t, n, p);
+    }
+  }
+  else
+  {
+    if (j->prev)
+    {
+      decimate_cf32_kernel(ib, f->coef, f->coef_len, step, 1, p);
+      ib += step;
+    }
+    for (t = 0; t < j->nout; t += n)
+    {
+      n = (j->nout - t < DEMOD_TILE) ? j->nout - t : DEMOD_TILE;
+      decimate_cf32_kernel(ib + t * step, f->coef, f->coef_len, step, n, iq);
+      polar_disc(d->custom_atan, iq, j->fm + t, n, p);
+    }
+  }
+
+  /* nothing of them on the mono fallback */
+  if (!j->fir || !j->present)
+    return;
+  for (t = hist; t < j->nout; t += n)
+  {
+    n = (j->nout - t < LP_REAL_TILE) ? j->nout - t : LP_REAL_TILE;
+    stereo_fir_f32(&d->lpr, j->fm + t - hist, j->fir + t, j->fir + j->nmax + t, j->fir + 2 * j->nmax + t, n, j->locked);
+  }
+}
+
+/* back in the demodulator thread and in order: the stereo filters of
+ the first samples, which need the history in lpr.br, and everything
+ after them into result like full_demod_fused */
+void demod_job_finish(struct demod_state *d, struct demod_job *j)
+{
+  float *br = d->lpr.br;
+  const float *fir = j->present ? j->fir : NULL;
+  int t, n, o = 0, hist = d->lpr.size - 1;
+
+  if (fir)
+  {
+    n = (j->nout < hist) ? j->nout : hist;
+    /* lp_real_run copies the block behind the history again */
+    memcpy(br + hist, j->fm, n * sizeof(float));
+    for (t = 0; t < n; t += LP_REAL_TILE)
+      stereo_fir_f32(&d->lpr, br + t, j->fir + t, j->fir + j->nmax + t, j->fir + 2 * j->nmax + t,
+          (n - t < LP_REAL_TILE) ? n - t : LP_REAL_TILE, j->locked);
+  }
+
+  for (t = 0; t < j->nout; t += n)
+  {
+    n = (j->nout - t < DEMOD_TILE) ? j->nout - t : DEMOD_TILE;
+    o = demod_tile_audio(d, j->fm + t, fir ? fir + t : NULL, j->nmax, j->locked, n, o);
+  }
+  d->result_len = o;
+}
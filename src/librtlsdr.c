@@ -39,6 +39,16 @@
 #define LIBUSB_CALL
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define ATOMIC_LOAD_ACQ(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_REL(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_FETCH_INC(p)		__atomic_fetch_add((p), 1, __ATOMIC_ACQ_REL)
+#else
+#define ATOMIC_LOAD_ACQ(p)		(MemoryBarrier(), *(p))
+#define ATOMIC_STORE_REL(p, v)	do { MemoryBarrier(); *(p) = (v); } while (0)
+#define ATOMIC_FETCH_INC(p)		(InterlockedIncrement((volatile LONG *)(p)) - 1)
+#endif
+
 /* two raised to the power of n */
 #define TWO_POW(n)		((double)(1ULL<<(n)))
 
@@ -98,6 +108,18 @@ struct rtlsdr_dev {
 	enum rtlsdr_async_status async_status;
 	int async_cancel;
 	int use_zerocopy;
+	/* held buffers mode, see rtlsdr_read_async_hold() */
+	int hold_buffers;
+	uint32_t xfer_buf_spare;
+	unsigned char **free_buf;	/* owned by the event thread */
+	uint32_t free_num;
+	struct libusb_transfer **parked; /* completed, waiting for a free buffer */
+	uint32_t parked_num;
+	uint32_t held_num;
+	unsigned char * volatile *ret_buf; /* released buffers, any thread */
+	volatile uint32_t ret_head;
+	uint32_t ret_tail;
+	int held_over; /* the stream stopped with buffers still held */
 	/* rtl demod context */
 	uint32_t rate; /* Hz */
 	uint32_t rtl_xtal; /* Hz */
@@ -1656,6 +1678,8 @@ err:
 	return r;
 }
 
+static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev);
+
 int rtlsdr_close(rtlsdr_dev_t *dev)
 {
 	if (!dev)
@@ -1674,6 +1698,10 @@ int rtlsdr_close(rtlsdr_dev_t *dev)
 		rtlsdr_deinit_baseband(dev);
 	}
 
+	/* the caller is done with the buffers it still held */
+	if (dev->held_over)
+		_rtlsdr_free_async_buffers(dev);
+
 	libusb_release_interface(dev->devh, 0);
 
 #ifdef DETACH_KERNEL_DRIVER
@@ -1713,15 +1741,70 @@ int rtlsdr_read_sync(rtlsdr_dev_t *dev, void *buf, int len, int *n_read)
 	return libusb_bulk_transfer(dev->devh, 0x81, buf, len, n_read, BULK_TIMEOUT);
 }
 
+/* move buffers given back by rtlsdr_release_buffer() to the free list and
+ * restart transfers that were parked for lack of a buffer */
+static void _rtlsdr_drain_released(rtlsdr_dev_t *dev)
+{
+	uint32_t total = dev->xfer_buf_num + dev->xfer_buf_spare;
+	uint32_t slot;
+	unsigned char *buf;
+	struct libusb_transfer *xfer;
+
+	for (;;) {
+		slot = dev->ret_tail % total;
+		buf = ATOMIC_LOAD_ACQ(&dev->ret_buf[slot]);
+		if (!buf)
+			break;
+		dev->ret_buf[slot] = NULL;
+		dev->ret_tail++;
+		dev->free_buf[dev->free_num++] = buf;
+		dev->held_num--;
+	}
+
+	while (dev->parked_num && dev->free_num &&
+	       RTLSDR_RUNNING == dev->async_status) {
+		xfer = dev->parked[--dev->parked_num];
+		xfer->buffer = dev->free_buf[--dev->free_num];
+		libusb_submit_transfer(xfer);
+	}
+}
+
+/* hand the filled buffer to the callback and keep the transfer going
+ * with a spare one, the filled buffer comes back later through
+ * rtlsdr_release_buffer() */
+static void _rtlsdr_hold_transfer(rtlsdr_dev_t *dev,
+				  struct libusb_transfer *xfer)
+{
+	_rtlsdr_drain_released(dev);
+
+	if (dev->cb) {
+		dev->held_num++;
+		dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
+	} else {
+		dev->free_buf[dev->free_num++] = xfer->buffer;
+	}
+
+	if (dev->free_num) {
+		xfer->buffer = dev->free_buf[--dev->free_num];
+		libusb_submit_transfer(xfer);
+	} else {
+		dev->parked[dev->parked_num++] = xfer;
+	}
+}
+
 static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
 {
 	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)xfer->user_data;
 
 	if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
-		if (dev->cb)
-			dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
+		if (dev->hold_buffers) {
+			_rtlsdr_hold_transfer(dev, xfer);
+		} else {
+			if (dev->cb)
+				dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
 
-		libusb_submit_transfer(xfer); /* resubmit transfer */
+			libusb_submit_transfer(xfer); /* resubmit transfer */
+		}
 		dev->xfer_errors = 0;
 	} else if (LIBUSB_TRANSFER_CANCELLED != xfer->status) {
 #ifndef _WIN32
@@ -1749,10 +1832,13 @@ int rtlsdr_wait_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx)
 static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 {
 	unsigned int i;
+	unsigned int total;
 
 	if (!dev)
 		return -1;
 
+	total = dev->xfer_buf_num + dev->xfer_buf_spare;
+
 	if (!dev->xfer) {
 		dev->xfer = malloc(dev->xfer_buf_num *
 				   sizeof(struct libusb_transfer *));
@@ -1764,14 +1850,14 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 	if (dev->xfer_buf)
 		return -2;
 
-	dev->xfer_buf = malloc(dev->xfer_buf_num * sizeof(unsigned char *));
-	memset(dev->xfer_buf, 0, dev->xfer_buf_num * sizeof(unsigned char *));
+	dev->xfer_buf = malloc(total * sizeof(unsigned char *));
+	memset(dev->xfer_buf, 0, total * sizeof(unsigned char *));
 
 #if defined(ENABLE_ZEROCOPY) && defined (__linux__) && LIBUSB_API_VERSION >= 0x01000105
-	fprintf(stderr, "Allocating %d zero-copy buffers\n", dev->xfer_buf_num);
+	fprintf(stderr, "Allocating %d zero-copy buffers\n", total);
 
 	dev->use_zerocopy = 1;
-	for (i = 0; i < dev->xfer_buf_num; ++i) {
+	for (i = 0; i < total; ++i) {
 		dev->xfer_buf[i] = libusb_dev_mem_alloc(dev->devh, dev->xfer_buf_len);
 
 		if (dev->xfer_buf[i]) {
@@ -1802,7 +1888,7 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 	/* zero-copy buffer allocation failed (partially or completely)
 	 * we need to free the buffers again if already allocated */
 	if (!dev->use_zerocopy) {
-		for (i = 0; i < dev->xfer_buf_num; ++i) {
+		for (i = 0; i < total; ++i) {
 			if (dev->xfer_buf[i])
 				libusb_dev_mem_free(dev->devh,
 						    dev->xfer_buf[i],
@@ -1813,7 +1899,7 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 
 	/* no zero-copy available, allocate buffers in userspace */
 	if (!dev->use_zerocopy) {
-		for (i = 0; i < dev->xfer_buf_num; ++i) {
+		for (i = 0; i < total; ++i) {
 			dev->xfer_buf[i] = malloc(dev->xfer_buf_len);
 
 			if (!dev->xfer_buf[i])
@@ -1821,6 +1907,24 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 		}
 	}
 
+	if (dev->hold_buffers) {
+		dev->free_buf = malloc(total * sizeof(unsigned char *));
+		dev->parked = malloc(dev->xfer_buf_num *
+				     sizeof(struct libusb_transfer *));
+		dev->ret_buf = calloc(total, sizeof(unsigned char *));
+		if (!dev->free_buf || !dev->parked || !dev->ret_buf)
+			return -ENOMEM;
+
+		/* transfers start on the first buffers, the rest are spares */
+		for (i = dev->xfer_buf_num; i < total; ++i)
+			dev->free_buf[i - dev->xfer_buf_num] = dev->xfer_buf[i];
+		dev->free_num = dev->xfer_buf_spare;
+		dev->parked_num = 0;
+		dev->held_num = 0;
+		dev->ret_head = 0;
+		dev->ret_tail = 0;
+	}
+
 	return 0;
 }
 
@@ -1843,7 +1947,7 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 	}
 
 	if (dev->xfer_buf) {
-		for (i = 0; i < dev->xfer_buf_num; ++i) {
+		for (i = 0; i < dev->xfer_buf_num + dev->xfer_buf_spare; ++i) {
 			if (dev->xfer_buf[i]) {
 				if (dev->use_zerocopy) {
 #if defined (__linux__) && LIBUSB_API_VERSION >= 0x01000105
@@ -1861,15 +1965,24 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 		dev->xfer_buf = NULL;
 	}
 
+	free(dev->free_buf);
+	free(dev->parked);
+	free((void *)dev->ret_buf);
+	dev->free_buf = NULL;
+	dev->parked = NULL;
+	dev->ret_buf = NULL;
+
 	return 0;
 }
 
-int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
-			  uint32_t buf_num, uint32_t buf_len)
+static int _rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb,
+			      void *ctx, uint32_t buf_num, uint32_t buf_len,
+			      int hold, uint32_t spare_num)
 {
 	unsigned int i;
 	int r = 0;
 	struct timeval tv = { 1, 0 };
+	struct timeval parkedtv = { 0, 1000 };
 	struct timeval zerotv = { 0, 0 };
 	enum rtlsdr_async_status next_status = RTLSDR_INACTIVE;
 
@@ -1879,11 +1992,22 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	if (RTLSDR_INACTIVE != dev->async_status)
 		return -2;
 
+	/* buffers held over from the last stream go once all are back */
+	if (dev->held_over) {
+		_rtlsdr_drain_released(dev);
+		if (dev->held_num)
+			return -2;
+		_rtlsdr_free_async_buffers(dev);
+		dev->held_over = 0;
+	}
+
 	dev->async_status = RTLSDR_RUNNING;
 	dev->async_cancel = 0;
 
 	dev->cb = cb;
 	dev->cb_ctx = ctx;
+	dev->hold_buffers = hold;
+	dev->xfer_buf_spare = hold ? spare_num : 0;
 
 	if (buf_num > 0)
 		dev->xfer_buf_num = buf_num;
@@ -1895,7 +2019,15 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	else
 		dev->xfer_buf_len = DEFAULT_BUF_LENGTH;
 
-	_rtlsdr_alloc_async_buffers(dev);
+	r = _rtlsdr_alloc_async_buffers(dev);
+	if (hold && r < 0) {
+		_rtlsdr_free_async_buffers(dev);
+		dev->hold_buffers = 0;
+		dev->xfer_buf_spare = 0;
+		dev->async_status = RTLSDR_INACTIVE;
+		return r;
+	}
+	r = 0;
 
 	for(i = 0; i < dev->xfer_buf_num; ++i) {
 		libusb_fill_bulk_transfer(dev->xfer[i],
@@ -1921,8 +2053,13 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	}
 
 	while (RTLSDR_INACTIVE != dev->async_status) {
-		r = libusb_handle_events_timeout_completed(dev->ctx, &tv,
-							   &dev->async_cancel);
+		/* parked transfers wait for rtlsdr_release_buffer(),
+		 * which cannot interrupt the event handling, so poll */
+		r = libusb_handle_events_timeout_completed(dev->ctx,
+				dev->parked_num ? &parkedtv : &tv,
+				&dev->async_cancel);
+		if (dev->hold_buffers)
+			_rtlsdr_drain_released(dev);
 		if (r < 0) {
 			/*fprintf(stderr, "handle_events returned: %d\n", r);*/
 			if (r == LIBUSB_ERROR_INTERRUPTED) /* stray signal */
@@ -1936,6 +2073,11 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 			if (!dev->xfer)
 				break;
 
+			/* parked transfers are not submitted, nothing to cancel */
+			while (dev->parked_num)
+				dev->parked[--dev->parked_num]->status =
+					LIBUSB_TRANSFER_CANCELLED;
+
 			for(i = 0; i < dev->xfer_buf_num; ++i) {
 				if (!dev->xfer[i])
 					continue;
@@ -1969,13 +2111,63 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 		}
 	}
 
-	_rtlsdr_free_async_buffers(dev);
+	/* buffers still held by the caller must not be freed under it,
+	 * give it a second to release them */
+	for (i = 0; dev->hold_buffers && i < 1000; ++i) {
+		_rtlsdr_drain_released(dev);
+		if (!dev->held_num)
+			break;
+#ifdef _WIN32
+		Sleep(1);
+#else
+		usleep(1000);
+#endif
+	}
 
+	/* otherwise they are kept, with the ring they come back through,
+	 * until the next read or rtlsdr_close() */
+	if (dev->hold_buffers && dev->held_num) {
+		dev->held_over = 1;
+	} else {
+		_rtlsdr_free_async_buffers(dev);
+		dev->xfer_buf_spare = 0;
+	}
+
+	dev->hold_buffers = 0;
 	dev->async_status = next_status;
 
 	return r;
 }
 
+int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
+			  uint32_t buf_num, uint32_t buf_len)
+{
+	return _rtlsdr_read_async(dev, cb, ctx, buf_num, buf_len, 0, 0);
+}
+
+int rtlsdr_read_async_hold(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb,
+			   void *ctx, uint32_t buf_num, uint32_t buf_len,
+			   uint32_t spare_num)
+{
+	return _rtlsdr_read_async(dev, cb, ctx, buf_num, buf_len, 1,
+				  spare_num);
+}
+
+int rtlsdr_release_buffer(rtlsdr_dev_t *dev, unsigned char *buf)
+{
+	uint32_t slot;
+
+	if (!dev || !buf || !dev->ret_buf)
+		return -1;
+
+	/* the ring has one slot per buffer, so a slot is always free */
+	slot = ATOMIC_FETCH_INC(&dev->ret_head) %
+		(dev->xfer_buf_num + dev->xfer_buf_spare);
+	ATOMIC_STORE_REL(&dev->ret_buf[slot], buf);
+
+	return 0;
+}
+
 int rtlsdr_cancel_async(rtlsdr_dev_t *dev)
 {
 	if (!dev)
@@ -0,0 +1,552 @@
+/*
+ * rtl_fm_bench, times the float FM demodulator of rtl_fm_player on
+ * synthetic or recorded IQ, stage by stage and as a whole
+ * Based on rtl_fm_streamer by Albrecht Lohoefener
+ * Based on "rtl_fm", see http://sdr.osmocom.org/trac/wiki/rtl-sdr for details
+ *
+ * Copyright (C) 2012 by Steve Markgraf <steve@steve-m.de>
+ * Copyright (C) 2012 by Hoernchen <la@tfc-server.de>
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ * Copyright (C) 2013 by Elias Oenal <EliasOenal@gmail.com>
+ * Copyright (C) 2015 by Miroslav Slugen <thunder.m@email.cz>
+ * Copyright (C) 2015 by Albrecht Lohoefener <albrechtloh@gmx.de>
+ * Copyright (C) 2024 by Rafael Ferrari <rafaelbf@hotmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include "getopt/getopt.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "fm_dsp.h"
+#include "iq_file.h"
+
+/* what -X runs at, 192 kHz FM times 8 */
+#define BENCH_RATE_IN		192000
+#define BENCH_DOWNSAMPLE	8
+#define BENCH_RATE_IQ		(BENCH_RATE_IN * BENCH_DOWNSAMPLE)
+#define BENCH_RATE_OUT		48000
+/* stations of the channel split comparison, up to half of the bank */
+#define BENCH_CHANNELS		8
+
+enum
+{
+  ST_ROTATE,
+  ST_LP,
+  ST_FM_DEMOD,
+  ST_LP_REAL,
+  ST_DEEMPH,
+  ST_CONVERT,
+  ST_COUNT
+};
+
+static const char *stage_names[ST_COUNT] =
+{ "rotate_90_u8_f32", "lp_f32", "fm_demod_f32", "lp_real_f32", "deemph_filter_f32", "convert_f32_s16" };
+
+struct bench_time
+{
+  double t;
+  double samples;
+};
+
+void usage(void)
+{
+  fprintf(
+  stderr, "rtl_fm_bench, times the FM demodulator of rtl_fm_player\n\n"
+      "Use:\trtl_fm_bench [-options]\n"
+      "\t[-t seconds of synthetic stereo IQ (default: 10)]\n"
+      "\t[-I iq_file, raw u8 IQ at %d S/s instead]\n"
+      "\t[-r repeats, the best is reported (default: 3)]\n"
+      "\t[-A std/fast/lut choose atan math (default: fast)]\n"
+      "\t[-L lowpass_taps (default: 32)]\n"
+      "\t[-E nosimd use only the scalar DSP code]\n"
+      "\n", BENCH_RATE_IQ);
+  exit(1);
+}
+
+static double bench_now(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER f, t;
+
+  QueryPerformanceFrequency(&f);
+  QueryPerformanceCounter(&t);
+  return (double) t.QuadPart / (double) f.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* FM stereo station at -fs/4 as rotate_90_u8_f32 expects it, L is 1 kHz,
+ R 2.5 kHz, 19 kHz pilot, 75 kHz deviation and a little noise */
+static void gen_mpx_iq(uint8_t *buf, long n)
+{
+  double t, l, r, mpx, ph = 0, fs = BENCH_RATE_IQ;
+  unsigned int seed = 1;
+  long i;
+
+  for (i = 0; i < n; i++)
+  {
+    t = i / fs;
+    l = 0.45 * sin(2 * M_PI * 1000 * t);
+    r = 0.45 * sin(2 * M_PI * 2500 * t);
+    mpx = 0.9 * ((l + r) / 2 + (l - r) / 2 * sin(2 * M_PI * 38000 * t)) + 0.1 * sin(2 * M_PI * 19000 * t);
+    ph += 2 * M_PI * (75000 * mpx - fs / 4) / fs;
+    if (ph > M_PI) ph -= 2 * M_PI;
+    if (ph < -M_PI) ph += 2 * M_PI;
+    seed = seed * 1103515245u + 12345u;
+    buf[2 * i] = (uint8_t) lrint(127.5 + 110 * cos(ph) + ((seed >> 16) & 7) - 3.5);
+    seed = seed * 1103515245u + 12345u;
+    buf[2 * i + 1] = (uint8_t) lrint(127.5 + 110 * sin(ph) + ((seed >> 16) & 7) - 3.5);
+  }
+}
+
+static uint8_t *read_iq(const char *name, long *len)
+{
+  FILE *f;
+  uint8_t *buf;
+  struct iq_header hdr;
+  long size, skip = 0;
+
+  f = fopen(name, "rb");
+  if (!f)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  /* recordings made with -W start with a header page */
+  if (fread(&hdr, sizeof(hdr), 1, f) == 1 && memcmp(hdr.magic, IQREC_MAGIC, sizeof(hdr.magic)) == 0)
+  {
+    if (hdr.rate != BENCH_RATE_IQ)
+      fprintf(stderr, "WARNING: %s was captured at %u S/s\n", name, hdr.rate);
+    skip = hdr.header_size;
+  }
+  fseek(f, skip, SEEK_SET);
+  size -= skip;
+
+  buf = malloc(size > 0 ? size : 1);
+  if (!buf || size <= 0 || fread(buf, 1, size, f) != (size_t) size)
+  {
+    free(buf);
+    fclose(f);
+    return NULL;
+  }
+  fclose(f);
+  *len = size;
+  return buf;
+}
+
+static struct demod_state *bench_demod(int mode, int taps, int atan_mode, int multipass)
+{
+  struct demod_state *d = calloc(1, sizeof(*d));
+
+  if (!d)
+    return NULL;
+  d->rate_in = BENCH_RATE_IN;
+  d->rate_out = BENCH_RATE_IN;
+  d->rate_out2 = BENCH_RATE_OUT;
+  d->downsample = BENCH_DOWNSAMPLE;
+  d->post_downsample = 1;
+  d->lp_taps = taps;
+  d->multipass = multipass;
+  d->custom_atan = atan_mode;
+  d->deemph = DEEMPHASIS_FM_EU;
+  d->deemph_lambda = (float) exp(-1.0 / ((double) BENCH_RATE_OUT * d->deemph));
+  d->volume = 0.4f;
+  d->lpr.mode = mode;
+  d->lpr.size = 128;
+  if (init_decimator_f32(&d->decim, d->downsample, d->lp_taps, MAXIMUM_BUF_LENGTH) < 0 ||
+      init_demod_arena(d, MAXIMUM_BUF_LENGTH, 0) < 0 || init_lp_real_f32(d) < 0)
+  {
+    fprintf(stderr, "Failed to set up the demodulator\n");
+    exit(1);
+  }
+  return d;
+}
+
+static void bench_free(struct demod_state *d)
+{
+  deinit_demod_jobs(d);
+  deinit_decimator_f32(&d->decim);
+  deinit_lp_real_f32(d);
+  deinit_demod_arena(d);
+  free(d);
+}
+
+/* one block as full_demod_multipass runs it, every stage timed apart */
+static void run_stages(struct demod_state *d, uint8_t *iq, long len, struct bench_time *st)
+{
+  long pos;
+  double t0, t1;
+
+  for (pos = 0; pos + MAXIMUM_BUF_LENGTH <= len; pos += MAXIMUM_BUF_LENGTH)
+  {
+    d->buf = iq + pos;
+    d->buf_len = MAXIMUM_BUF_LENGTH;
+
+    t0 = bench_now();
+    rotate_90_u8_f32(d);
+    t1 = bench_now();
+    st[ST_ROTATE].t += t1 - t0;
+    st[ST_ROTATE].samples += d->buf_len / 2;
+
+    lp_f32(d);
+    t0 = bench_now();
+    st[ST_LP].t += t0 - t1;
+    st[ST_LP].samples += d->buf_len / 2;
+
+    st[ST_FM_DEMOD].samples += d->lp_len / 2;
+    fm_demod_f32(d);
+    t1 = bench_now();
+    st[ST_FM_DEMOD].t += t1 - t0;
+
+    st[ST_LP_REAL].samples += d->result_len;
+    lp_real_f32(d);
+    t0 = bench_now();
+    st[ST_LP_REAL].t += t0 - t1;
+
+    deemph_filter_f32(d);
+    t1 = bench_now();
+    st[ST_DEEMPH].t += t1 - t0;
+    st[ST_DEEMPH].samples += d->result_len;
+
+    convert_f32_s16(d);
+    t0 = bench_now();
+    st[ST_CONVERT].t += t0 - t1;
+    st[ST_CONVERT].samples += d->result_len;
+  }
+}
+
+/* what demod_thread_fn does per block */
+static double run_full(struct demod_state *d, uint8_t *iq, long len)
+{
+  long pos;
+  double t0 = bench_now();
+
+  for (pos = 0; pos + MAXIMUM_BUF_LENGTH <= len; pos += MAXIMUM_BUF_LENGTH)
+  {
+    d->buf = iq + pos;
+    d->buf_len = MAXIMUM_BUF_LENGTH;
+    rotate_90_u8_f32(d);
+    full_demod(d);
+  }
+  return bench_now() - t0;
+}
+
+/* -P on one thread: what stays in demod_thread_fn and what the
+ workers take, *tw gets the time of the workers */
+static double run_jobs(struct demod_state *d, uint8_t *iq, long len, double *tw)
+{
+  struct demod_job *j = &d->jobs[0];
+  long pos;
+  double t0, t1, t2, ts = 0;
+
+  *tw = 0;
+  for (pos = 0; pos + MAXIMUM_BUF_LENGTH <= len; pos += MAXIMUM_BUF_LENGTH)
+  {
+    d->buf = iq + pos;
+    d->buf_len = MAXIMUM_BUF_LENGTH;
+    t0 = bench_now();
+    demod_job_start(d, j);
+    rotate_90_u8_f32(d);
+    demod_job_cut(d, j);
+    t1 = bench_now();
+    demod_job_run(j);
+    t2 = bench_now();
+    demod_job_finish(d, j);
+    ts += (t1 - t0) + (bench_now() - t2);
+    *tw += t2 - t1;
+  }
+  return ts;
+}
+
+/* -C: every channel mixes and decimates the whole input by itself */
+static double run_split_mixer(uint8_t *iq, long len, int channels)
+{
+  struct demod_state *d[BENCH_CHANNELS];
+  long pos;
+  double t0;
+  int c;
+
+  for (c = 0; c < channels; c++)
+  {
+    d[c] = bench_demod(0, 16 * BENCH_DOWNSAMPLE, ATAN_FAST, 1);
+    init_mixer_f32(&d[c]->mix, (c + 1) * BENCH_RATE_IN / 2, BENCH_RATE_IQ);
+  }
+
+  t0 = bench_now();
+  for (pos = 0; pos + MAXIMUM_BUF_LENGTH <= len; pos += MAXIMUM_BUF_LENGTH)
+  {
+    for (c = 0; c < channels; c++)
+    {
+      d[c]->buf = iq + pos;
+      d[c]->buf_len = MAXIMUM_BUF_LENGTH;
+      mix_u8_f32(d[c]);
+      lp_f32(d[c]);
+    }
+  }
+  t0 = bench_now() - t0;
+
+  for (c = 0; c < channels; c++)
+    bench_free(d[c]);
+  return t0;
+}
+
+/* -C -E pfb: one filter bank pass gives all of them */
+static double run_split_pfb(uint8_t *iq, long len, int channels)
+{
+  struct pfb_f32 p;
+  float *ob[BENCH_CHANNELS];
+  int bins[BENCH_CHANNELS];
+  long pos;
+  double t0;
+  int c;
+
+  if (init_pfb_f32(&p, 2 * BENCH_DOWNSAMPLE, BENCH_DOWNSAMPLE, 8, MAXIMUM_BUF_LENGTH) < 0)
+  {
+    fprintf(stderr, "Failed to set up the filter bank\n");
+    exit(1);
+  }
+  for (c = 0; c < channels; c++)
+  {
+    bins[c] = c + 1;
+    ob[c] = malloc(MAXIMUM_BUF_LENGTH * sizeof(float));
+  }
+
+  t0 = bench_now();
+  for (pos = 0; pos + MAXIMUM_BUF_LENGTH <= len; pos += MAXIMUM_BUF_LENGTH)
+  {
+    pfb_u8(&p, iq + pos, MAXIMUM_BUF_LENGTH);
+    while (pfb_f32(&p, bins, channels, ob, MAXIMUM_BUF_LENGTH / 2) > 0)
+      ;
+  }
+  t0 = bench_now() - t0;
+
+  for (c = 0; c < channels; c++)
+    free(ob[c]);
+  deinit_pfb_f32(&p);
+  return t0;
+}
+
+static void print_row(const char *name, double samples, double t, double secs)
+{
+  printf("%-26s %12.0f %10.2f %10.1f %12.1f\n", name, samples,
+      t * 1e9 / samples, samples / t * 1e-6, secs / t);
+}
+
+int main(int argc, char **argv)
+{
+  static const char *mode_names[3] = { "nearest", "mono", "stereo" };
+  struct bench_time st[3][ST_COUNT], best[3][ST_COUNT];
+  struct demod_state *d;
+  uint8_t *iq;
+  char name[64];
+  const char *kernels;
+  char *in_name = NULL;
+  double secs = 10, t, tf, tw, tp;
+  long len;
+  int opt, i, r, mode, mp, repeats = 3, taps = 32, atan_mode = ATAN_FAST, enable_simd = 1;
+
+  while ((opt = getopt(argc, argv, "t:I:r:A:L:E:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 't':
+      secs = atof(optarg);
+      break;
+    case 'I':
+      in_name = optarg;
+      break;
+    case 'r':
+      repeats = atoi(optarg);
+      break;
+    case 'A':
+      if (strcmp("std", optarg) == 0)
+        atan_mode = ATAN_STD;
+      if (strcmp("fast", optarg) == 0)
+        atan_mode = ATAN_FAST;
+      if (strcmp("lut", optarg) == 0)
+        atan_mode = ATAN_LUT;
+      break;
+    case 'L':
+      taps = atoi(optarg);
+      if (taps < 16 || taps > 512)
+        usage();
+      break;
+    case 'E':
+      if (strcmp("nosimd", optarg) == 0)
+        enable_simd = 0;
+      break;
+    case 'h':
+    default:
+      usage();
+      break;
+    }
+  }
+  if (repeats < 1 || secs <= 0)
+    usage();
+
+  init_u8_f32_table();
+  init_atan_lut();
+  kernels = init_simd(enable_simd);
+
+  if (in_name)
+  {
+    iq = read_iq(in_name, &len);
+    if (!iq)
+    {
+      fprintf(stderr, "Failed to read %s\n", in_name);
+      exit(1);
+    }
+  }
+  else
+  {
+    len = 2 * (long) (secs * BENCH_RATE_IQ);
+    iq = malloc(len);
+    if (!iq)
+    {
+      fprintf(stderr, "Failed to allocate %ld bytes\n", len);
+      exit(1);
+    }
+    gen_mpx_iq(iq, len / 2);
+  }
+  /* whole blocks only, as the dongle delivers them */
+  len -= len % MAXIMUM_BUF_LENGTH;
+  if (len == 0)
+  {
+    fprintf(stderr, "Less than one block of IQ\n");
+    exit(1);
+  }
+  secs = (double) (len / 2) / BENCH_RATE_IQ;
+
+  printf("%.1f s of %s IQ at %d S/s, %s kernels, %d taps, best of %d\n\n",
+      secs, in_name ? in_name : "synthetic stereo", BENCH_RATE_IQ, kernels, taps, repeats);
+
+  /* stage by stage, every lp_real mode */
+  for (mode = 0; mode < 3; mode++)
+  {
+    for (r = 0; r < repeats; r++)
+    {
+      memset(st[mode], 0, sizeof(st[mode]));
+      d = bench_demod(mode, taps, atan_mode, 1);
+      run_stages(d, iq, len, st[mode]);
+      bench_free(d);
+      for (i = 0; i < ST_COUNT; i++)
+      {
+        if (r == 0 || st[mode][i].t < best[mode][i].t)
+          best[mode][i] = st[mode][i];
+      }
+    }
+  }
+
+  printf("%-26s %12s %10s %10s %12s\n", "stage", "samples", "ns/sample", "MS/s", "x realtime");
+  for (i = 0; i < ST_COUNT; i++)
+  {
+    if (i == ST_LP_REAL)
+    {
+      for (mode = 0; mode < 3; mode++)
+      {
+        snprintf(name, sizeof(name), "%s %s", stage_names[i], mode_names[mode]);
+        print_row(name, best[mode][i].samples, best[mode][i].t, secs);
+      }
+      continue;
+    }
+    print_row(stage_names[i], best[2][i].samples, best[2][i].t, secs);
+  }
+  printf("(stereo decoder for the other stages, deemph and convert count L and R)\n");
+
+  /* the whole chain per input sample, as demod_thread_fn runs it */
+  printf("\n%-26s %12s %10s %10s %12s\n", "pipeline", "samples", "ns/sample", "MS/s", "x realtime");
+  for (mode = 1; mode < 3; mode++)
+  {
+    for (mp = 0; mp < 2; mp++)
+    {
+      tf = 0;
+      for (r = 0; r < repeats; r++)
+      {
+        d = bench_demod(mode, taps, atan_mode, mp);
+        t = run_full(d, iq, len);
+        bench_free(d);
+        if (r == 0 || t < tf)
+          tf = t;
+      }
+      snprintf(name, sizeof(name), "%s %s", mode_names[mode], mp ? "multipass" : "fused");
+      print_row(name, (double) (len / 2), tf, secs);
+    }
+  }
+
+  /* -P: the part of the fused chain that stays in the demodulator
+   thread bounds what more threads can give */
+  printf("\n%-26s %12s %10s %10s %12s\n", "threads (-P)", "samples", "ns/sample", "MS/s", "x realtime");
+  for (mode = 1; mode < 3; mode++)
+  {
+    tf = tp = 0;
+    for (r = 0; r < repeats; r++)
+    {
+      d = bench_demod(mode, taps, atan_mode, 0);
+      if (init_demod_jobs(d, 1) < 0)
+      {
+        fprintf(stderr, "Failed to allocate the demodulator jobs\n");
+        exit(1);
+      }
+      t = run_jobs(d, iq, len, &tw);
+      bench_free(d);
+      if (r == 0 || t + tw < tf + tp)
+      {
+        tf = t;
+        tp = tw;
+      }
+    }
+    snprintf(name, sizeof(name), "%s serial", mode_names[mode]);
+    print_row(name, (double) (len / 2), tf, secs);
+    snprintf(name, sizeof(name), "%s workers", mode_names[mode]);
+    print_row(name, (double) (len / 2), tp, secs);
+  }
+
+  /* splitting the capture into channels, before any demodulation */
+  printf("\n%-26s %12s %10s %10s %12s\n", "channels", "samples", "ns/sample", "MS/s", "x realtime");
+  for (i = 1; i <= BENCH_CHANNELS; i *= 2)
+  {
+    for (mp = 0; mp < 2; mp++)
+    {
+      tf = 0;
+      for (r = 0; r < repeats; r++)
+      {
+        t = mp ? run_split_pfb(iq, len, i) : run_split_mixer(iq, len, i);
+        if (r == 0 || t < tf)
+          tf = t;
+      }
+      snprintf(name, sizeof(name), "%s x%d", mp ? "pfb" : "mixer", i);
+      print_row(name, (double) (len / 2), tf, secs);
+    }
+  }
+
+  free(iq);
+  return 0;
+}
@@ -25,6 +25,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* sync_file_range */
+#endif
 
 #include <errno.h>
 #include <signal.h>
@@ -37,6 +40,9 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #else
 #include <windows.h>
 #include <fcntl.h>
@@ -49,10 +55,19 @@
 #endif
 #define _USE_MATH_DEFINES
 #endif
+#ifndef _MSC_VER
+#include <sys/time.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
+
 #include <libusb.h>
 
 #define SDL_MAIN_HANDLED
@@ -86,6 +101,30 @@ void usage(void)
       "\t    deemp:  enable de-emphasis filter\n"
       "\t    direct: enable direct sampling\n"
       "\t    offset: enable offset tuning\n"
+      "\t    zerocopy: demodulate straight from the USB buffers\n"
+      "\t    nosimd: use only the scalar DSP code\n"
+      "\t    multipass: reference DSP, one pass per stage\n"
+      "\t    pace:   read the -I file in real time\n"
+      "\t    pfb:    split the -C capture with one filter bank, the\n"
+      "\t            stations have to be on a 100 kHz grid\n"
+      "\t    lowlat: live audio about 50 ms behind the air, small\n"
+      "\t            blocks cost more CPU, -V prints the latency\n"
+      "\t    pull:   the audio device reads the timeshift buffer\n"
+      "\t            itself, seeks are heard on its next period\n"
+      "\t    compress: keep the timeshift buffer losslessly packed,\n"
+      "\t            about twice the history in the same RAM, not with -S\n"
+      "\t[-I iq_file (default: the dongle)]\n"
+      "\t    raw 8 bit IQ as written by rtl_sdr, '-' reads stdin\n"
+      "\t    captured at the frequency and rate shown with -V\n"
+      "\t    without -E pace it runs as fast as possible and exits at the end\n"
+      "\t[-W iq_file record the raw IQ stream from the start]\n"
+      "\t[-M minutes of timeshift (default: about 16, 120 with -S)]\n"
+      "\t[-S scratch_file keep the timeshift on disk instead of in RAM]\n"
+      "\t    only the last seconds stay in memory, the file is deleted\n"
+      "\t    as soon as it is open and needs room for all -M minutes\n"
+      "\t[-C freq,freq,... also demodulate these stations out of the same capture]\n"
+      "\t    each one is recorded to filename_<kHz>.wav, -f is the one played\n"
+      "\t    all of them have to fit in 3.2 MHz, no tuning while running\n"
       "\tfilename (.wav file format)\n"
       "\t[-X Start with FM Stereo support]\n"
       "\t[-Y Start with FM Mono support]\n"
@@ -93,12 +132,19 @@ void usage(void)
       "\n"
       "Experimental options:\n"
       "\t[-r resample_rate (default: 48000)]\n"
+      "\t    any rate whose ratio to the demodulator rate reduces\n"
+      "\t    to at most 1024 phases, like 44.1k, 32k or 22.05k\n"
       "\t[-t squelch_delay (default: 10)]\n"
       "\t    +values will mute/scan, -values will exit\n"
       "\t[-F fir_size (default: off)]\n"
       "\t    enables low-leakage downsample filter\n"
       "\t    size can be 0 or 9.  0 has bad roll off\n"
-      "\t[-A std/fast/lut choose atan math (default: std)]\n"
+      "\t[-A std/fast/lut choose atan math (default: fast)]\n"
+      "\t[-L lowpass_taps (default: 32)]\n"
+      "\t    taps of the first downsample filter, 16 to 512\n"
+      "\t[-P threads (default: 0/off)]\n"
+      "\t    filter the blocks of every station on a pool of 1 to 16\n"
+      "\t    threads, the audio is the same as without\n"
       "\n");
   exit(1);
 }
@@ -131,6 +177,207 @@ static void sighandler(int signum)
 #define safe_cond_wait(n, m) pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m)
 
 
+/* lock-free input ring between the libusb thread and the demodulator */
+void ring_init(struct spsc_ring *r, char *buf, uint32_t size)
+{
+  r->buf = buf;
+  r->size = size;
+  r->mask = size - 1;
+  r->head = 0;
+  r->tail = 0;
+  r->seq = 0;
+  r->waiting = 0;
+  r->room_seq = 0;
+  r->room_waiting = 0;
+  r->closed = 0;
+  pthread_mutex_init(&r->wait_m, NULL);
+  pthread_cond_init(&r->wait_c, NULL);
+}
+
+void ring_cleanup(struct spsc_ring *r)
+{
+  pthread_mutex_destroy(&r->wait_m);
+  pthread_cond_destroy(&r->wait_c);
+}
+
+/* INPUT_RING_MS of a stream, a power of two of 4 to 16 blocks */
+static uint32_t input_ring_size(uint32_t bytes_per_second, uint32_t block)
+{
+  uint64_t want = (uint64_t) bytes_per_second * INPUT_RING_MS / 1000;
+  uint32_t size = 4 * block;
+
+  while (size < want && size < 16 * block)
+    size <<= 1;
+  return size;
+}
+
+/* bytes available for the consumer */
+static uint32_t ring_used(struct spsc_ring *r)
+{
+  return ATOMIC_LOAD_ACQ(&r->head) - r->tail;
+}
+
+/* bytes the producer can write */
+static uint32_t ring_room(struct spsc_ring *r)
+{
+  return r->size - (r->head - ATOMIC_LOAD_ACQ(&r->tail));
+}
+
+/* the consumer and the producer wait on their own seq, both share the
+ condvar where there is no futex */
+static void ring_signal(struct spsc_ring *r, volatile uint32_t *seq, volatile int *waiting)
+{
+  /* pairs with the fence in ring_sleep, one side always sees the other */
+  ATOMIC_FENCE();
+  if (!*waiting)
+    return;
+
+#ifdef __linux__
+  __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&r->wait_m);
+  (*seq)++;
+  pthread_cond_broadcast(&r->wait_c);
+  pthread_mutex_unlock(&r->wait_m);
+#endif
+}
+
+static void ring_wake(struct spsc_ring *r)
+{
+  ring_signal(r, &r->seq, &r->waiting);
+}
+
+/* producer side, after the last write */
+static void ring_close(struct spsc_ring *r)
+{
+  ATOMIC_STORE_REL(&r->closed, 1);
+  ring_wake(r);
+}
+
+/* producer side, never blocks: whole block is written or dropped */
+uint32_t ring_write(struct spsc_ring *r, const void *data, uint32_t len)
+{
+  uint32_t head = r->head, pos, part;
+
+  if (len > r->size - (head - ATOMIC_LOAD_ACQ(&r->tail)))
+    return 0;
+
+  pos = head & r->mask;
+  part = r->size - pos;
+  if (part >= len)
+  {
+    memcpy(r->buf + pos, data, len);
+  }
+  else
+  {
+    memcpy(r->buf + pos, data, part);
+    memcpy(r->buf, (const char *) data + part, len - part);
+  }
+  ATOMIC_STORE_REL(&r->head, head + len);
+
+  ring_wake(r);
+  return len;
+}
+
+/* consumer side, caller made sure len bytes are available */
+void ring_read(struct spsc_ring *r, void *data, uint32_t len)
+{
+  uint32_t tail = r->tail, pos, part;
+
+  pos = tail & r->mask;
+  part = r->size - pos;
+  if (part >= len)
+  {
+    memcpy(data, r->buf + pos, len);
+  }
+  else
+  {
+    memcpy(data, r->buf + pos, part);
+    memcpy((char *) data + part, r->buf, len - part);
+  }
+  ATOMIC_STORE_REL(&r->tail, tail + len);
+
+  ring_signal(r, &r->room_seq, &r->room_waiting);
+}
+
+/* until *seq moves on from the value it had before *waiting was set */
+static void ring_sleep(struct spsc_ring *r, volatile uint32_t *seq, uint32_t old, int timeout_ms)
+{
+  struct timespec ts;
+#ifndef __linux__
+  struct timeval tv;
+#endif
+
+#ifdef __linux__
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, seq, FUTEX_WAIT_PRIVATE, old, &ts, NULL, 0);
+#else
+  gettimeofday(&tv, NULL);
+  ts.tv_sec = tv.tv_sec + timeout_ms / 1000;
+  ts.tv_nsec = (tv.tv_usec + (timeout_ms % 1000) * 1000L) * 1000L;
+  if (ts.tv_nsec >= 1000000000L)
+  {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&r->wait_m);
+  while (*seq == old)
+  {
+    if (pthread_cond_timedwait(&r->wait_c, &r->wait_m, &ts) == ETIMEDOUT)
+      break;
+  }
+  pthread_mutex_unlock(&r->wait_m);
+#endif
+}
+
+/* consumer side, sleep until len bytes are available
+ returns 0 on timeout or early wakeup so the caller can check exit flags */
+int ring_wait(struct spsc_ring *r, uint32_t len, int timeout_ms)
+{
+  uint32_t seq;
+
+  if (ring_used(r) >= len)
+    return 1;
+
+  seq = ATOMIC_LOAD_ACQ(&r->seq);
+  r->waiting = 1;
+  ATOMIC_FENCE();
+  if (ring_used(r) >= len)
+  {
+    r->waiting = 0;
+    return 1;
+  }
+  ring_sleep(r, &r->seq, seq, timeout_ms);
+
+  r->waiting = 0;
+  return ring_used(r) >= len;
+}
+
+/* producer side, the same until len bytes can be written */
+static int ring_wait_room(struct spsc_ring *r, uint32_t len, int timeout_ms)
+{
+  uint32_t seq;
+
+  if (ring_room(r) >= len)
+    return 1;
+
+  seq = ATOMIC_LOAD_ACQ(&r->room_seq);
+  r->room_waiting = 1;
+  ATOMIC_FENCE();
+  if (ring_room(r) >= len)
+  {
+    r->room_waiting = 0;
+    return 1;
+  }
+  ring_sleep(r, &r->room_seq, seq, timeout_ms);
+
+  r->room_waiting = 0;
+  return ring_room(r) >= len;
+}
+
+
 #ifdef _MSC_VER
 double log2(double n)
 {
@@ -191,607 +438,280 @@ int _getch(void)
 #endif
 }
 
-
-void init_u8_f32_table()
+static void dongle_mute(struct dongle_state *s, unsigned char *buf)
 {
   int i;
 
-  for (i = 0; i < 256; i++)
-  {
-    u8_f32_table[0][i] = ((float) i - 127.5f) / 128.0f;
-    u8_f32_table[1][i] = ((float) i - 127.5f) / -128.0f;
-  }
-}
-
-void rotate_90_u8_f32(struct demod_state *d)
-/* 90 rotation is 1+0j, 0+1j, -1+0j, 0-1j
- or [0, 1, -3, 2, -4, -5, 7, -6] */
-{
-  float *ob = (float*) d->lowpassed;
-  uint32_t i;
-
-  for (i = 0; i < d->buf_len; i += 8)
+  if (s->mute)
   {
-    ob[i] = u8_f32_table[0][d->buf[i]];
-    ob[i + 1] = u8_f32_table[0][d->buf[i + 1]];
-    ob[i + 2] = u8_f32_table[1][d->buf[i + 3]];
-    ob[i + 3] = u8_f32_table[0][d->buf[i + 2]];
-    ob[i + 4] = u8_f32_table[1][d->buf[i + 4]];
-    ob[i + 5] = u8_f32_table[1][d->buf[i + 5]];
-    ob[i + 6] = u8_f32_table[0][d->buf[i + 7]];
-    ob[i + 7] = u8_f32_table[1][d->buf[i + 6]];
+    for (i = 0; i < s->mute; i++)
+      buf[i] = 127;
+    s->mute = 0;
   }
-
-  d->lp_len = d->buf_len;
 }
 
-void u8_f32(struct demod_state *d)
+void iqrec_init(struct iq_recorder *r)
 {
-  float *ob = (float*) d->lowpassed;
-  uint32_t i;
-
-  for (i = 0; i < d->buf_len; i++)
-  {
-    ob[i] = u8_f32_table[0][d->buf[i]];
-  }
-
-  d->lp_len = d->buf_len;
+  r->active = 0;
+  r->writing = 0;
+  r->running = 0;
+  r->ring_buf = NULL;
+#ifdef _WIN32
+  r->file = NULL;
+  r->chunk = NULL;
+#else
+  r->fd = -1;
+  r->map = NULL;
+#endif
 }
 
-void init_lp_f32()
+void iqrec_cleanup(struct iq_recorder *r)
 {
-  int i;
-  float j;
-
-  for (i = 0; i < 16; i++)
-  {
-    j = (float) i - 15.5f;
-    lp_filter_f32[i] = (sinf(0.125f * PI_F * j) / (PI_F * j)) * (0.54f - 0.46f * cosf(PI_F * (float) i / 15.5f));
-  }
-}
-
-void lp_f32(struct demod_state *d)
-{
-  int i, j;
-  float xb[6] =
-  { 0 }, *ob = (float*) d->lowpassed, *tb = d->lowpass_tb, *fb = lp_filter_f32;
-
-    /* first three reads needs data from tmp buffer */
-    /* I - 0 */
-    xb[0] = (tb[ 0] + ob[14]) * fb[0] +
-            (tb[ 2] + ob[12]) * fb[1] +
-            (tb[ 4] + ob[10]) * fb[2] +
-            (tb[ 6] + ob[ 8]) * fb[3] +
-            (tb[ 8] + ob[ 6]) * fb[4] +
-            (tb[10] + ob[ 4]) * fb[5] +
-            (tb[12] + ob[ 2]) * fb[6] +
-            (tb[14] + ob[ 0]) * fb[7] +
-            (tb[16] + tb[46]) * fb[8] +
-            (tb[18] + tb[44]) * fb[9] +
-            (tb[20] + tb[42]) * fb[10] +
-            (tb[22] + tb[40]) * fb[11] +
-            (tb[24] + tb[38]) * fb[12] +
-            (tb[26] + tb[36]) * fb[13] +
-            (tb[28] + tb[34]) * fb[14] +
-            (tb[30] + tb[32]) * fb[15];
-    /* Q - 0 */
-    xb[1] = (tb[ 1] + ob[15]) * fb[0] +
-            (tb[ 3] + ob[13]) * fb[1] +
-            (tb[ 5] + ob[11]) * fb[2] +
-            (tb[ 7] + ob[ 9]) * fb[3] +
-            (tb[ 9] + ob[ 7]) * fb[4] +
-            (tb[11] + ob[ 5]) * fb[5] +
-            (tb[13] + ob[ 3]) * fb[6] +
-            (tb[15] + ob[ 1]) * fb[7] +
-            (tb[17] + tb[47]) * fb[8] +
-            (tb[19] + tb[45]) * fb[9] +
-            (tb[21] + tb[43]) * fb[10] +
-            (tb[23] + tb[41]) * fb[11] +
-            (tb[25] + tb[39]) * fb[12] +
-            (tb[27] + tb[37]) * fb[13] +
-            (tb[29] + tb[35]) * fb[14] +
-            (tb[31] + tb[33]) * fb[15];
-
-    /* I - 1 */
-    xb[2] = (tb[16] + ob[30]) * fb[0] +
-            (tb[18] + ob[28]) * fb[1] +
-            (tb[20] + ob[26]) * fb[2] +
-            (tb[22] + ob[24]) * fb[3] +
-            (tb[24] + ob[22]) * fb[4] +
-            (tb[26] + ob[20]) * fb[5] +
-            (tb[28] + ob[18]) * fb[6] +
-            (tb[30] + ob[16]) * fb[7] +
-            (tb[32] + ob[14]) * fb[8] +
-            (tb[34] + ob[12]) * fb[9] +
-            (tb[36] + ob[10]) * fb[10] +
-            (tb[38] + ob[ 8]) * fb[11] +
-            (tb[40] + ob[ 6]) * fb[12] +
-            (tb[42] + ob[ 4]) * fb[13] +
-            (tb[44] + ob[ 2]) * fb[14] +
-            (tb[46] + ob[ 0]) * fb[15];
-    /* Q - 1 */
-    xb[3] = (tb[17] + ob[31]) * fb[0] +
-            (tb[19] + ob[29]) * fb[1] +
-            (tb[21] + ob[27]) * fb[2] +
-            (tb[23] + ob[25]) * fb[3] +
-            (tb[25] + ob[23]) * fb[4] +
-            (tb[27] + ob[21]) * fb[5] +
-            (tb[29] + ob[19]) * fb[6] +
-            (tb[31] + ob[17]) * fb[7] +
-            (tb[33] + ob[15]) * fb[8] +
-            (tb[35] + ob[13]) * fb[9] +
-            (tb[37] + ob[11]) * fb[10] +
-            (tb[39] + ob[ 9]) * fb[11] +
-            (tb[41] + ob[ 7]) * fb[12] +
-            (tb[43] + ob[ 5]) * fb[13] +
-            (tb[45] + ob[ 3]) * fb[14] +
-            (tb[47] + ob[ 1]) * fb[15];
-
-    /* I - 2 */
-    xb[4] = (tb[32] + ob[46]) * fb[0] +
-            (tb[34] + ob[44]) * fb[1] +
-            (tb[36] + ob[42]) * fb[2] +
-            (tb[38] + ob[40]) * fb[3] +
-            (tb[40] + ob[38]) * fb[4] +
-            (tb[42] + ob[36]) * fb[5] +
-            (tb[44] + ob[34]) * fb[6] +
-            (tb[46] + ob[32]) * fb[7] +
-            (ob[ 0] + ob[30]) * fb[8] +
-            (ob[ 2] + ob[28]) * fb[9] +
-            (ob[ 4] + ob[26]) * fb[10] +
-            (ob[ 6] + ob[24]) * fb[11] +
-            (ob[ 8] + ob[22]) * fb[12] +
-            (ob[10] + ob[20]) * fb[13] +
-            (ob[12] + ob[18]) * fb[14] +
-            (ob[14] + ob[16]) * fb[15];
-    /* Q - 2 */
-    xb[5] = (tb[33] + ob[47]) * fb[0] +
-            (tb[35] + ob[45]) * fb[1] +
-            (tb[37] + ob[43]) * fb[2] +
-            (tb[39] + ob[41]) * fb[3] +
-            (tb[41] + ob[39]) * fb[4] +
-            (tb[43] + ob[37]) * fb[5] +
-            (tb[45] + ob[35]) * fb[6] +
-            (tb[47] + ob[33]) * fb[7] +
-            (ob[ 1] + ob[31]) * fb[8] +
-            (ob[ 3] + ob[29]) * fb[9] +
-            (ob[ 5] + ob[27]) * fb[10] +
-            (ob[ 7] + ob[25]) * fb[11] +
-            (ob[ 9] + ob[23]) * fb[12] +
-            (ob[11] + ob[21]) * fb[13] +
-            (ob[13] + ob[19]) * fb[14] +
-            (ob[15] + ob[17]) * fb[15];
-
-  /* store last 24 IQ values for next read */
-  memcpy(tb, &(ob[d->lp_len - 48]), 192);
-
-    /* next reads are direct */
-    for (i = 0, j = 6; j < d->lp_len >> 3; i+= 16, j+= 2) {
-        /* I */
-        ob[j] = (ob[i     ] + ob[i + 62]) * fb[0] +
-                (ob[i +  2] + ob[i + 60]) * fb[1] +
-                (ob[i +  4] + ob[i + 58]) * fb[2] +
-                (ob[i +  6] + ob[i + 56]) * fb[3] +
-                (ob[i +  8] + ob[i + 54]) * fb[4] +
-                (ob[i + 10] + ob[i + 52]) * fb[5] +
-                (ob[i + 12] + ob[i + 50]) * fb[6] +
-                (ob[i + 14] + ob[i + 48]) * fb[7] +
-                (ob[i + 16] + ob[i + 46]) * fb[8] +
-                (ob[i + 18] + ob[i + 44]) * fb[9] +
-                (ob[i + 20] + ob[i + 42]) * fb[10] +
-                (ob[i + 22] + ob[i + 40]) * fb[11] +
-                (ob[i + 24] + ob[i + 38]) * fb[12] +
-                (ob[i + 26] + ob[i + 36]) * fb[13] +
-                (ob[i + 28] + ob[i + 34]) * fb[14] +
-                (ob[i + 30] + ob[i + 32]) * fb[15];
-        /* Q */
-        ob[j + 1] = (ob[i + 1] + ob[i + 63]) * fb[0] +
-                (ob[i +  3] + ob[i + 61]) * fb[1] +
-                (ob[i +  5] + ob[i + 59]) * fb[2] +
-                (ob[i +  7] + ob[i + 57]) * fb[3] +
-                (ob[i +  9] + ob[i + 55]) * fb[4] +
-                (ob[i + 11] + ob[i + 53]) * fb[5] +
-                (ob[i + 13] + ob[i + 51]) * fb[6] +
-                (ob[i + 15] + ob[i + 49]) * fb[7] +
-                (ob[i + 17] + ob[i + 47]) * fb[8] +
-                (ob[i + 19] + ob[i + 45]) * fb[9] +
-                (ob[i + 21] + ob[i + 43]) * fb[10] +
-                (ob[i + 23] + ob[i + 41]) * fb[11] +
-                (ob[i + 25] + ob[i + 39]) * fb[12] +
-                (ob[i + 27] + ob[i + 37]) * fb[13] +
-                (ob[i + 29] + ob[i + 35]) * fb[14] +
-                (ob[i + 31] + ob[i + 33]) * fb[15];
-    }
-
-  /* copy data back to output buffer after encoding */
-  memcpy(ob, xb, 24);
-
-  /* output has always fixed size */
-  d->lp_len >>= 3;
+  free(r->ring_buf);
+  r->ring_buf = NULL;
+#ifdef _WIN32
+  free(r->chunk);
+  r->chunk = NULL;
+#endif
 }
 
-void init_lp_real_f32(struct demod_state *fm)
+#ifndef _WIN32
+/* move to the window at off. the finished one is handed to writeback
+ right away and the one before it, written by now, leaves the page
+ cache, so hours of IQ don't push everything else out of memory */
+static int iqrec_map(struct iq_recorder *r, uint64_t off)
 {
-  int i;
-  float fmh, fpl, fph, fsl, fsh, fv, fi, fh, wf;
-
-  if (_beverbose)
-    fprintf(stderr, "Init FIR hamming, size: %d sample_rate: %d\n", fm->lpr.size, fm->rate_in);
-  fm->lpr.rsize = (fm->lpr.size >> 1);
-  wf = PI2_F * 19000.0f / (float) fm->rate_in;
-  fm->lpr.swf = sinf(wf);
-  fm->lpr.cwf = cosf(wf);
-  fm->lpr.pp = 0;
-  fmh = 16000.0f / (float) fm->rate_in;
-  fpl = 18000.0f / (float) fm->rate_in;
-  fph = 20000.0f / (float) fm->rate_in;
-  fsl = 21000.0f / (float) fm->rate_in;
-  fsh = 55000.0f / (float) fm->rate_in;
-  fm->lpr.br = calloc(fm->lpr.size, 4);
-  fm->lpr.bm = calloc(fm->lpr.size, 4);
-  fm->lpr.bs = calloc(fm->lpr.size, 4);
-  /* filters are symetrical, so only half size */
-  fm->lpr.fm = calloc(fm->lpr.size >> 1, 4);
-  fm->lpr.fp = calloc(fm->lpr.size >> 1, 4);
-  fm->lpr.fs = calloc(fm->lpr.size >> 1, 4);
-  fm->lpr.pos = 0;
-  for (i = 0; i < fm->lpr.rsize; i++)
-  {
-    fi = (float) i - (float) (fm->lpr.size - 1) / 2.0f;
-    /* hamming window */
-    fh = 0.54f - 0.46f * cosf(PI2_F * (float) i / (float) (fm->lpr.size - 1));
-    /* low pass */
-    fv = (fi == 0) ? 2.0f * fmh : sinf(PI2_F * fmh * fi) / (PI_F * fi);
-    fm->lpr.fm[i] = fv * fh;
-    /* pilot band pass */
-    fv = (fi == 0) ? 2.0f * (fph - fpl) : (sinf(PI2_F * fph * fi) - sinf(PI2_F * fpl * fi)) / (PI_F * fi);
-    fm->lpr.fp[i] = fv * fh;
-    /* stereo band pass */
-    fv = (fi == 0) ? 2.0f * (fsh - fsl) : (sinf(PI2_F * fsh * fi) - sinf(PI2_F * fsl * fi)) / (PI_F * fi);
-    fm->lpr.fs[i] = fv * fh;
-  }
-}
-
-void deinit_lp_real_f32(struct demod_state *fm)
-{
-  fm->lpr.rsize = 0;
-  free(fm->lpr.br);
-  free(fm->lpr.bm);
-  free(fm->lpr.bs);
-  free(fm->lpr.fm);
-  free(fm->lpr.fp);
-  free(fm->lpr.fs);
-  fm->lpr.br = NULL;
-  fm->lpr.bm = NULL;
-  fm->lpr.bs = NULL;
-  fm->lpr.fm = NULL;
-  fm->lpr.fp = NULL;
-  fm->lpr.fs = NULL;
-}
-
-float sin2atan2_f32(float x, float y)
-{
-  float z;
-
-  if (x == 0.f) return 0.f;
-
-  z = y / x;
-
-  return (z + z) / (1.f + (z * z));
-}
-
-void lp_real_f32(struct demod_state *fm)
-{
-  int i, j, k, l, o = 0, fast = (int) fm->rate_out, slow = (int) fm->rate_out2;
-  float v, vm, vp, vs, *ib = (float*) fm->result;
-
-  switch (fm->lpr.mode)
-  {
-  case 0:
-    for (i = 0; i < fm->result_len; i++)
-    {
-      if ((fm->prev_lpr_index += slow) >= fast)
-      {
-        fm->prev_lpr_index -= fast;
-        ib[o++] = ib[i];
-      }
-    }
-    break;
-  case 1: /* Mono */
-    for (i = 0; i < fm->result_len; i++)
-    {
-      fm->lpr.br[fm->lpr.pos] = ib[i];
-
-      if (++fm->lpr.pos == fm->lpr.size) fm->lpr.pos = 0;
-
-      if ((fm->prev_lpr_index += slow) >= fast)
-      {
-        fm->prev_lpr_index -= fast;
-
-        for (j = fm->lpr.pos, k = 0, l = fm->lpr.pos, vm = 0; k < fm->lpr.rsize; k++)
-        {
-          /* next value before storing, easiest way to get complementary index */
-          if (l == 0)
-          {
-            l = fm->lpr.size - 1;
-          }
-          else
-          {
-            l--;
-          }
-
-          vm += (fm->lpr.br[j] + fm->lpr.br[l]) * fm->lpr.fm[k];
-
-          /* next value after storing */
-          if (++j == fm->lpr.size) j = 0;
-        }
-
-        ib[o++] = vm;
-      }
-    }
-    break;
-  case 2: /* Stereo */
-    for (i = 0; i < fm->result_len; i++)
+  if (r->map)
+  {
+    munmap(r->map, IQREC_WINDOW);
+    r->map = NULL;
+#ifdef __linux__
+    sync_file_range(r->fd, r->map_off, IQREC_WINDOW, SYNC_FILE_RANGE_WRITE);
+    if (r->map_off >= IQREC_WINDOW)
     {
-      fm->lpr.br[fm->lpr.pos] = ib[i];
-
-      for (j = fm->lpr.pos, k = 0, l = fm->lpr.pos, vm = 0, vp = 0, vs = 0; k < fm->lpr.rsize; k++)
-      {
-        /* next value after storing */
-        if (++j == fm->lpr.size) j = 0;
-
-        v = fm->lpr.br[j] + fm->lpr.br[l];
-
-        vm += v * fm->lpr.fm[k]; /* L+R low pass (0 Hz ... 17 kHz) */
-        vp += v * fm->lpr.fp[k]; /* Pilot frequency band pass (18 kHz ... 20 kHz) --> filters out the 19 kHz */
-        vs += v * fm->lpr.fs[k]; /* L-R band pass (21 kHz ... 55 kHz) */
-
-        /* next value before storing, easiest way to get complementary index */
-        if (l == 0)
-        {
-          l = fm->lpr.size - 1;
-        }
-        else
-        {
-          l--;
-        }
-      }
-
-      fm->lpr.bm[fm->lpr.pos] = vm;
-
-      /* AM L-R demodulation
-       sin2atan2f(...) doubles the pilot frequency 19 kHz --> 38 kHz
-       vs * sin2atan2_f32(...) AM demodulation */
-      fm->lpr.bs[fm->lpr.pos] = vs * sin2atan2_f32(vp * fm->lpr.swf, vp * fm->lpr.cwf - fm->lpr.pp);
-      fm->lpr.pp = vp;
-
-      if (++fm->lpr.pos == fm->lpr.size) fm->lpr.pos = 0;
-
-      if ((fm->prev_lpr_index += slow) >= fast)
-      {
-        fm->prev_lpr_index -= fast;
-
-        for (j = fm->lpr.pos, k = 0, l = fm->lpr.pos, vm = 0, vs = 0; k < fm->lpr.rsize; k++)
-        {
-          /* next value before storing, easiest way to get complementary index */
-          if (l == 0)
-          {
-            l = fm->lpr.size - 1;
-          }
-          else
-          {
-            l--;
-          }
-
-          vm += (fm->lpr.bm[j] + fm->lpr.bm[l]) * fm->lpr.fm[k]; /* low pass (0 Hz ... 17 kHz) */
-          vs += (fm->lpr.bs[j] + fm->lpr.bs[l]) * fm->lpr.fm[k]; /* low pass (0 Hz ... 17 kHz), removes unwanted AM demodulation high frequencies */
-
-          /* next value after storing */
-          if (++j == fm->lpr.size) j = 0;
-        }
-
-        /* we can overwrite input, but not for downsample input buffer 16384 
-         Calculate stereo signal */
-        ib[o] = vm + vs;
-        ib[o + 1] = vm - vs;
-        o += 2;
-      }
+      sync_file_range(r->fd, r->map_off - IQREC_WINDOW, IQREC_WINDOW,
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(r->fd, r->map_off - IQREC_WINDOW, IQREC_WINDOW, POSIX_FADV_DONTNEED);
     }
-    break;
-  }
-
-  fm->result_len = o;
-}
-
-/* absolute error < 0.0015, computation error: 0.012%, mono: 0.010, stereo: 0.007% */
-static float atan2_lagrange_f32(float y, float x)
-{
-  float z;
-
-  if (x == 0.f)
-  {
-    if (y < 0.f) return -PI_2_F;
-    if (y > 0.f) return PI_2_F;
-    return 0.f;
+#endif
   }
 
-  if (y == 0.f) return (x < 0.f) ? PI_F : 0.f;
+  /* reserve the blocks now, not on the first page fault, where there
+   is no posix_fallocate the file only grows */
+#ifdef __linux__
+  if (posix_fallocate(r->fd, off, IQREC_WINDOW) != 0 &&
+      ftruncate(r->fd, off + IQREC_WINDOW) < 0)
+    return -1;
+#else
+  if (ftruncate(r->fd, off + IQREC_WINDOW) < 0)
+    return -1;
+#endif
 
-  /* Q3 + Q2 */
-  if (x < 0.f)
+  r->map = mmap(NULL, IQREC_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, off);
+  if (r->map == MAP_FAILED)
   {
-    /* Q3 + */
-    if (y < 0.f)
-    {
-      /* abs(x) >= abs(y) */
-      if (x <= y)
-      {
-        z = y / x;
-        return z * (PI_4_F - (z - 1.f) * (0.2447f + 0.0663f * z)) - PI_F;
-      }
-      /* abs(x) < abs(y) */
-      z = x / y;
-      return z * (-PI_4_F + (z - 1.f) * (0.2447f + 0.0663f * z)) - PI_2_F;
-    }
-    /* Q2 - */
-    if (-x >= y)
-    {
-      z = y / x;
-      return z * (PI_4_F + (z + 1.f) * (0.2447f - 0.0663f * z)) + PI_F;
-    }
-    z = x / y;
-    return PI_2_F - z * (PI_4_F + (z + 1.f) * (0.2447f - 0.0663f * z));
+    r->map = NULL;
+    return -1;
   }
+  madvise(r->map, IQREC_WINDOW, MADV_SEQUENTIAL);
+  r->map_off = off;
+  r->map_pos = 0;
+  return 0;
+}
+#endif
 
-  /* Q4 - */
-  if (y < 0.f)
+/* cut the preallocated tail and write the final header */
+static void iqrec_finish(struct iq_recorder *r)
+{
+#ifdef _WIN32
+  if (r->file)
   {
-    if (x >= -y)
-    {
-      z = y / x;
-      return z * (PI_4_F + (z + 1.f) * (0.2447f - 0.0663f * z));
-    }
-    z = x / y;
-    return z * (-PI_4_F - (z + 1.f) * (0.2447f - 0.0663f * z)) - PI_2_F;
+    fseek(r->file, 0, SEEK_SET);
+    fwrite(&r->hdr, sizeof(r->hdr), 1, r->file);
+    fclose(r->file);
+    r->file = NULL;
   }
-
-  /* Q1 + */
-  if (x >= y)
+#else
+  if (r->fd >= 0)
   {
-    z = y / x;
-    return z * (PI_4_F - (z - 1.f) * (0.2447f + 0.0663f * z));
+    if (r->map)
+      munmap(r->map, IQREC_WINDOW);
+    r->map = NULL;
+    if (ftruncate(r->fd, IQREC_HEADER_SIZE + r->hdr.data_len) < 0 ||
+        pwrite(r->fd, &r->hdr, sizeof(r->hdr), 0) != sizeof(r->hdr))
+      fprintf(stderr, "\nError finishing %s: %s\n", r->filename, strerror(errno));
+    close(r->fd);
+    r->fd = -1;
   }
-
-  z = x / y;
-  return PI_2_F - z * (PI_4_F - (z - 1.f) * (0.2447f + 0.0663f * z));
+#endif
 }
 
-void fm_demod_f32(struct demod_state *fm)
+/* n bytes of the staging ring into the file */
+static int iqrec_put(struct iq_recorder *r, uint32_t n)
 {
-  int i;
-  float *ib = (float*) fm->lowpassed, *ob = (float*) fm->result, v;
-
-  fm->result_len = 0;
+  uint32_t part;
 
-  for (i = 0; i < fm->lp_len; i += 2)
+  while (n > 0)
   {
-    /* atanf function needs more computer power, better is to use approximation */
-    v = atan2_lagrange_f32(fm->pre_r_f32 * ib[i + 1] - fm->pre_j_f32 * ib[i],
-        ib[i] * fm->pre_r_f32 + ib[i + 1] * fm->pre_j_f32);
-    fm->pre_r_f32 = ib[i];
-    fm->pre_j_f32 = ib[i + 1];
-    ob[fm->result_len++] = v;
+#ifdef _WIN32
+    part = n < IQREC_CHUNK ? n : IQREC_CHUNK;
+    ring_read(&r->ring, r->chunk, part);
+    if (fwrite(r->chunk, 1, part, r->file) != part)
+      return -1;
+#else
+    if (r->map_pos == IQREC_WINDOW && iqrec_map(r, r->map_off + IQREC_WINDOW) < 0)
+      return -1;
+    part = IQREC_WINDOW - r->map_pos;
+    if (part > n) part = n;
+    ring_read(&r->ring, r->map + r->map_pos, part);
+    r->map_pos += part;
+#endif
+    r->hdr.data_len += part;
+    n -= part;
   }
+  return 0;
 }
 
-void deemph_filter_f32(struct demod_state *fm)
+/* everything that may wait for the card happens here */
+static void * iqrec_thread_fn(void *arg)
 {
-  int i;
-  float *ib = (float*) fm->result;
+  struct iq_recorder *r = arg;
+  uint32_t n;
+  int closed;
 
-  if (fm->lpr.mode == 2)
+  for (;;)
   {
-    for (i = 0; i < fm->result_len; i += 2)
+    /* closed first, all that was written before it is seen then */
+    closed = ATOMIC_LOAD_ACQ(&r->ring.closed);
+    n = ring_used(&r->ring);
+    if (!n)
     {
-      /* left */
-      fm->deemph_l_f32 = (ib[i] += fm->deemph_lambda * (fm->deemph_l_f32 - ib[i]));
-      /* right */
-      fm->deemph_r_f32 = (ib[i + 1] += fm->deemph_lambda * (fm->deemph_r_f32 - ib[i + 1]));
+      if (closed)
+        break;
+      ring_wait(&r->ring, 1, 100);
+      continue;
     }
-  }
-  else
-  {
-    for (i = 0; i < fm->result_len; i++)
+    if (iqrec_put(r, n) < 0)
     {
-      fm->deemph_l_f32 = (ib[i] += fm->deemph_lambda * (fm->deemph_l_f32 - ib[i]));
+      fprintf(stderr, "\nIQ recording stopped, can't write %s\n", r->filename);
+      ATOMIC_STORE_REL(&r->active, 0);
+      break;
     }
   }
+
+  iqrec_finish(r);
+  if (r->dropped)
+    fprintf(stderr, "\n%llu bytes of IQ did not fit in the staging buffer of %s\n",
+            (unsigned long long) r->dropped, r->filename);
+  return 0;
 }
 
-void convert_f32_s16(struct demod_state *fm)
+/* from the main thread, waits until the file is finished */
+void iqrec_stop(struct iq_recorder *r)
 {
-  int i;
-  float *ib = (float*) fm->result, coef;
-  int16_t *ob = (int16_t*) fm->result;
-
-  coef = fm->volume * 32768.0f;
-
-  for (i = 0; i < fm->result_len; i++)
-  {
-    ib[i] *= coef;
-    if (ib[i] > 32767.0f)
-    {
-      ob[i] = 32767;
-    }
-    else if (ib[i] < -32768.0f)
-    {
-      ob[i] = -32768;
-    }
-    else
-    {
-      ob[i] = (int16_t) lrintf(ib[i]);
-    }
-  }
+  if (!r->running)
+    return;
+  ATOMIC_STORE_REL(&r->active, 0);
+  /* pairs with the fence in iqrec_write, one side sees the other */
+  ATOMIC_FENCE();
+  while (ATOMIC_LOAD_ACQ(&r->writing))
+    usleep(100);
+  ring_close(&r->ring);
+  pthread_join(r->thread, NULL);
+  ring_cleanup(&r->ring);
+  r->running = 0;
 }
 
-int rms(int16_t *samples, int len, int step)
-/* largely lifted from rtl_power */
+/* called before any sample is written, from the main thread */
+int iqrec_start(struct iq_recorder *r, const char *filename, struct dongle_state *d)
 {
-  int i;
-  long p, t, s;
-  double dc, err;
+  if (r->active)
+    return -1;
+  /* finish a recording that stopped itself on a write error */
+  iqrec_stop(r);
+
+  if (!r->ring_buf)
+    r->ring_buf = malloc(IQREC_STAGE);
+#ifdef _WIN32
+  if (!r->chunk)
+    r->chunk = malloc(IQREC_CHUNK);
+  if (!r->chunk)
+    return -1;
+#endif
+  if (!r->ring_buf)
+    return -1;
+
+  memset(&r->hdr, 0, sizeof(r->hdr));
+  memcpy(r->hdr.magic, IQREC_MAGIC, sizeof(r->hdr.magic));
+  r->hdr.header_size = IQREC_HEADER_SIZE;
+  r->hdr.freq = d->freq;
+  r->hdr.rate = d->rate;
+  r->hdr.ppm = d->ppm_error;
+  r->hdr.gain = d->gain;
+  r->hdr.start_time = (int64_t) time(NULL);
+  snprintf(r->filename, sizeof(r->filename), "%s", filename);
 
-  p = t = 0L;
-  for (i=0; i<len; i+=step) {
-    s = (long)samples[i];
-    t += s;
-    p += s * s;
+#ifdef _WIN32
+  r->file = fopen(filename, "wb");
+  if (!r->file)
+    return -1;
+  setvbuf(r->file, NULL, _IOFBF, 1 << 20);
+  fwrite(&r->hdr, sizeof(r->hdr), 1, r->file);
+  fseek(r->file, IQREC_HEADER_SIZE, SEEK_SET);
+#else
+  r->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (r->fd < 0)
+    return -1;
+  r->map = NULL;
+  if (iqrec_map(r, 0) < 0)
+  {
+    close(r->fd);
+    r->fd = -1;
+    return -1;
   }
-  /* correct for dc offset in squares */
-  dc = (double)(t*step) / (double)len;
-  err = t * 2 * dc - dc * dc * len;
+  /* the header is kept up to date in the file at stop */
+  r->map_pos = IQREC_HEADER_SIZE;
+#endif
 
-  return (int)sqrt((p-err) / len);
+  r->dropped = 0;
+  ring_init(&r->ring, r->ring_buf, IQREC_STAGE);
+  if (pthread_create(&r->thread, NULL, iqrec_thread_fn, r) != 0)
+  {
+    ring_cleanup(&r->ring);
+    iqrec_finish(r);
+    return -1;
+  }
+  r->running = 1;
+  ATOMIC_STORE_REL(&r->active, 1);
+  return 0;
 }
 
-
-void full_demod(struct demod_state *d)
+/* straight out of the transfer buffer into the staging ring. The USB
+ thread never waits, a block that finds the ring full is dropped. An
+ offline reader waits for the recorder thread instead */
+void iqrec_write(struct iq_recorder *r, const unsigned char *buf, uint32_t len, int wait)
 {
-  int i, ds_p;
-  int sr = 0;
-
-  /* Low pass to filter only to the tuned FM channel */
-  lp_f32(d);
-
-  /* Shadow buffer to calculate the RMS */
-  memcpy(RMSShadowBuf, d->lowpassed, d->lp_len * sizeof(float));
-  RMSShadowBuf_len = d->lp_len;
-
-  /* FM demodulation */
-  fm_demod_f32(d); /* lowpassed -> result */
+  if (!ATOMIC_LOAD_ACQ(&r->active))
+    return;
 
-  /* todo, fm noise squelch */
-  
-  /* use nicer filter here too? */
-  if (d->post_downsample > 1)
+  r->writing = 1;
+  ATOMIC_FENCE();
+  while (r->active && !ring_write(&r->ring, buf, len))
   {
-    /* For float not implemented */
+    if (!wait)
+    {
+      r->dropped += len;
+      break;
+    }
+    ring_wait_room(&r->ring, len, 100);
   }
-
-  if (d->rate_out2 > 0)
-    lp_real_f32(d);
-
-  if (d->deemph)
-    deemph_filter_f32(d);
-
-  convert_f32_s16(d);
+  ATOMIC_STORE_REL(&r->writing, 0);
 }
 
 static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 {
-  int i;
   struct dongle_state *s = ctx;
-  struct demod_state *d = s->demod_target;
+  int i;
 
   if (_do_exit) { 
     rtlsdr_cancel_async(dongle.dev);
@@ -801,39 +721,46 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
     return;
   }
 
-  /* mute */
-  if (s->mute)
-  {
-    for (i = 0; i < s->mute; i++)
-      buf[i] = 127;
-    s->mute = 0;
-  }
+  iqrec_write(&iqrec, buf, len, 0);
+  dongle_mute(s, buf);
 
-  pthread_rwlock_wrlock(&d->rw);
-  if (_input_buffer_wpos + len <= _input_buffer_size_max)
+  /* never wait for the demodulator here, if the ring is full drop this block */
+  if (!ring_write(&_input_ring, buf, len))
   {
-    memcpy(_input_buffer + _input_buffer_wpos, buf, len);
-    _input_buffer_wpos += len;
-    _input_buffer_size += len;
-    /* begin new read with zero */
-    if (_input_buffer_wpos == _input_buffer_size_max) _input_buffer_wpos = 0;
+    if (_beverbose)
+      fprintf(stderr, "dropping input buffer: %u B\n", len);
   }
-  else
+  /* with the filter bank the channels are fed by pfb_thread_fn */
+  for (i = 0; i < _channel_count && !_pfb.active; i++)
   {
-    /* buffer_size_max must be multiple of len */
-    memcpy(_input_buffer, buf, len);
-    _input_buffer_wpos = len;
-    _input_buffer_size += len;
+    if (!ring_write(&_channels[i]->ring, buf, len) && _beverbose)
+      fprintf(stderr, "dropping input buffer of %u Hz: %u B\n", _channels[i]->freq, len);
+  }
+}
+
+/* zero-copy mode, the buffer is ours until demod_thread_fn releases it */
+static void rtlsdr_hold_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+  struct dongle_state *s = ctx;
+  struct iq_block blk;
+
+  if (_do_exit) { 
+    rtlsdr_release_buffer(s->dev, buf);
+    rtlsdr_cancel_async(s->dev);
+    return;
   }
-  /* already droped some data, so print info */
-  if (_input_buffer_size > _input_buffer_size_max)
+
+  iqrec_write(&iqrec, buf, len, 0);
+  dongle_mute(s, buf);
+
+  blk.buf = buf;
+  blk.len = len;
+  if (!ring_write(&_block_ring, &blk, sizeof(blk)))
   {
+    rtlsdr_release_buffer(s->dev, buf);
     if (_beverbose)
-      fprintf(stderr, "dropping input buffer: %u B\n", _input_buffer_size - _input_buffer_size_max);
-    _input_buffer_size = _input_buffer_size_max;
+      fprintf(stderr, "dropping input buffer: %u B\n", len);
   }
-  pthread_rwlock_unlock(&d->rw);
-  /* safe_cond_signal(&d->ready, &d->ready_m); */
 }
 
 static void * dongle_thread_fn(void *arg)
@@ -843,7 +770,10 @@ static void * dongle_thread_fn(void *arg)
 
   if (_do_exit) return 0;
 
-  r= rtlsdr_read_async(s->dev, rtlsdr_callback, s, 0, 0);
+  if (s->zerocopy)
+    r = rtlsdr_read_async_hold(s->dev, rtlsdr_hold_callback, s, 0, _low_latency ? _read_block : 0, HOLD_SPARE_BUFFERS);
+  else
+    r = rtlsdr_read_async(s->dev, rtlsdr_callback, s, 0, _low_latency ? _read_block : 0);
   if (r < 0) {
       fprintf(stderr, "\nError reading from device.\nPress any key to exit.\n");
       _do_exit=1;
@@ -852,169 +782,960 @@ static void * dongle_thread_fn(void *arg)
   return 0;
 }
 
-static void * demod_thread_fn(void *arg)
+static void dongle_cancel(struct dongle_state *s)
 {
-  struct demod_state *d = arg;
-  struct output_state *o = d->output_target;
-  uint32_t len;
+  rtlsdr_cancel_async(s->dev);
+}
 
-  while (!_do_exit)
-  {
-    len = MAXIMUM_BUF_LENGTH;
-    while (_input_buffer_size < len)
+static double time_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void file_ring_write(struct spsc_ring *r, const void *data, uint32_t len)
+{
+  while (!ring_write(r, data, len))
+  {
+    if (_do_exit) break;
+    ring_wait_room(r, len, 100);
+  }
+}
+
+/* offline input, unlike the dongle nothing is dropped: when the ring
+ is full the reader waits for the demodulator */
+static void * file_thread_fn(void *arg)
+{
+  struct dongle_state *s = arg;
+  unsigned char *buf, *data;
+  struct iq_header hdr;
+  size_t len;
+  double start, ahead, sent = 0;
+  int first = 1;
+  int i;
+
+  buf = malloc(MAXIMUM_BUF_LENGTH);
+  if (!buf) {
+    _do_exit = 1;
+    return 0;
+  }
+
+  /* nothing may get lost before the output is open */
+  while (!_isStartStream && !_do_exit)
+    usleep(1000);
+
+  start = time_now();
+  while (!_do_exit)
+  {
+    len = fread(buf, 1, _read_block, s->in_file);
+    if (len == 0)
+      break;
+    data = buf;
+
+    /* our own IQ recordings start with a header page */
+    if (first && len >= IQREC_HEADER_SIZE && memcmp(buf, IQREC_MAGIC, 8) == 0)
+    {
+      memcpy(&hdr, buf, sizeof(hdr));
+      if (hdr.rate != s->rate || hdr.freq != s->freq)
+        fprintf(stderr, "\nWARNING: %s was captured at %u Hz, %u S/s\n", s->in_name, hdr.freq, hdr.rate);
+      data += IQREC_HEADER_SIZE;
+      len -= IQREC_HEADER_SIZE;
+    }
+    first = 0;
+
+    iqrec_write(&iqrec, data, (uint32_t) len, 1);
+    dongle_mute(s, data);
+
+    file_ring_write(&_input_ring, data, (uint32_t) len);
+    for (i = 0; i < _channel_count && !_pfb.active; i++)
+      file_ring_write(&_channels[i]->ring, data, (uint32_t) len);
+
+    if (s->pace)
+    {
+      sent += len / 2;
+      ahead = sent / s->rate - (time_now() - start);
+      if (ahead > 0)
+        usleep((int) (ahead * 1e6));
+    }
+  }
+
+  if (ferror(s->in_file))
+    fprintf(stderr, "\nError reading %s\n", s->in_name);
+
+  free(buf);
+  ATOMIC_STORE_REL(&s->eof, 1);
+  ring_close(&_input_ring);
+  for (i = 0; i < _channel_count && !_pfb.active; i++)
+    ring_close(&_channels[i]->ring);
+  return 0;
+}
+
+static void file_cancel(struct dongle_state *s)
+{
+  /* file_thread_fn checks _do_exit */
+}
+
+/* -E pfb, every input block is split into all the channels in one pass */
+static void * pfb_thread_fn(void *arg)
+{
+  struct pfb_state *p = arg;
+  unsigned char *buf;
+  uint32_t len;
+  int i, n;
+
+  buf = malloc(MAXIMUM_BUF_LENGTH);
+  if (!buf) {
+    _do_exit = 1;
+    return 0;
+  }
+
+  while (!_do_exit)
+  {
+    len = _read_block;
+    if (!ring_wait(&_input_ring, len, 100))
     {
-      if ((d->exit_flag) || (_do_exit)) return 0;
-      usleep(5000);
+      if (!ATOMIC_LOAD_ACQ(&_input_ring.closed))
+        continue;
+      len = ring_used(&_input_ring) & ~15u;
+      if (len == 0)
+        break;
     }
+    ring_read(&_input_ring, buf, len);
+    pfb_u8(&p->bank, buf, (int) len);
 
-    pthread_rwlock_wrlock(&d->rw);
-    memcpy(d->buf, _input_buffer + _input_buffer_rpos, len);
-    _input_buffer_rpos += len;
-    _input_buffer_size -= len;
-    if (_input_buffer_rpos == _input_buffer_size_max) _input_buffer_rpos = 0;
+    while ((n = pfb_f32(&p->bank, p->bins, p->nbins, p->ob, PFB_BLOCK)) > 0)
+    {
+      for (i = 0; i < p->nbins; i++)
+      {
+        if (dongle.in_file)
+          file_ring_write(p->out[i], p->ob[i], n * 2 * sizeof(float));
+        else if (!ring_write(p->out[i], p->ob[i], n * 2 * sizeof(float)) && _beverbose)
+          fprintf(stderr, "dropping channel buffer: %u B\n", (uint32_t) (n * 2 * sizeof(float)));
+      }
+    }
+  }
+
+  free(buf);
+  for (i = 0; i < p->nbins; i++)
+    ring_close(p->out[i]);
+  return 0;
+}
+
+/* own queue first, then the others from the other end */
+static struct demod_job * pool_take(struct pool_worker *w)
+{
+  struct pool_worker *v;
+  struct demod_job *j = NULL;
+  int i, k = (int) (w - _pool.w);
+
+  pthread_mutex_lock(&w->m);
+  if (w->head != w->tail)
+    j = w->job[w->head++ % POOL_QUEUE];
+  pthread_mutex_unlock(&w->m);
+
+  for (i = 1; i < _pool.workers && !j; i++)
+  {
+    v = &_pool.w[(k + i) % _pool.workers];
+    pthread_mutex_lock(&v->m);
+    if (v->head != v->tail)
+      j = v->job[--v->tail % POOL_QUEUE];
+    pthread_mutex_unlock(&v->m);
+  }
+
+  return j;
+}
+
+static void * pool_thread_fn(void *arg)
+{
+  struct pool_worker *w = arg;
+  struct demod_job *j;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&_pool.m);
+    while (!_pool.queued && !_pool.exit)
+      pthread_cond_wait(&_pool.work, &_pool.m);
+    if (_pool.exit)
+    {
+      pthread_mutex_unlock(&_pool.m);
+      break;
+    }
+    /* one of the queued jobs is ours, wherever it is */
+    _pool.queued--;
+    pthread_mutex_unlock(&_pool.m);
+
+    while (!(j = pool_take(w)))
+      sched_yield();
+    demod_job_run(j);
+
+    pthread_mutex_lock(&_pool.m);
+    j->done = 1;
+    pthread_cond_broadcast(&_pool.done);
+    pthread_mutex_unlock(&_pool.m);
+  }
+
+  return 0;
+}
+
+static void pool_submit(struct demod_job *j)
+{
+  struct pool_worker *w;
+
+  pthread_mutex_lock(&_pool.m);
+  w = &_pool.w[_pool.next];
+  _pool.next = (_pool.next + 1) % _pool.workers;
+  pthread_mutex_unlock(&_pool.m);
+
+  pthread_mutex_lock(&w->m);
+  w->job[w->tail++ % POOL_QUEUE] = j;
+  pthread_mutex_unlock(&w->m);
+
+  pthread_mutex_lock(&_pool.m);
+  _pool.queued++;
+  pthread_cond_signal(&_pool.work);
+  pthread_mutex_unlock(&_pool.m);
+}
+
+static void pool_wait(struct demod_job *j)
+{
+  pthread_mutex_lock(&_pool.m);
+  while (!j->done)
+    pthread_cond_wait(&_pool.done, &_pool.m);
+  pthread_mutex_unlock(&_pool.m);
+}
+
+static int pool_start(int workers)
+{
+  int i;
+
+  _pool.workers = workers;
+  _pool.next = 0;
+  _pool.queued = 0;
+  _pool.exit = 0;
+  pthread_mutex_init(&_pool.m, NULL);
+  pthread_cond_init(&_pool.work, NULL);
+  pthread_cond_init(&_pool.done, NULL);
+  for (i = 0; i < workers; i++)
+  {
+    _pool.w[i].head = _pool.w[i].tail = 0;
+    pthread_mutex_init(&_pool.w[i].m, NULL);
+    if (pthread_create(&_pool.w[i].thread, NULL, pool_thread_fn, (void *) (&_pool.w[i])) != 0)
+    {
+      _pool.workers = i;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* after the demodulators, they wait for their jobs before exiting */
+static void pool_stop(void)
+{
+  int i;
+
+  pthread_mutex_lock(&_pool.m);
+  _pool.exit = 1;
+  pthread_cond_broadcast(&_pool.work);
+  pthread_mutex_unlock(&_pool.m);
+  for (i = 0; i < _pool.workers; i++)
+  {
+    pthread_join(_pool.w[i].thread, NULL);
+    pthread_mutex_destroy(&_pool.w[i].m);
+  }
+  pthread_mutex_destroy(&_pool.m);
+  pthread_cond_destroy(&_pool.work);
+  pthread_cond_destroy(&_pool.done);
+  _pool.workers = 0;
+}
+
+static const struct input_source input_dongle = { "rtlsdr", dongle_thread_fn, dongle_cancel };
+static const struct input_source input_file = { "file", file_thread_fn, file_cancel };
+
+/* where the blocks of d come from and how long they are */
+static struct spsc_ring * demod_input(struct demod_state *d, uint32_t *len)
+{
+  if (dongle.zerocopy)
+  {
+    *len = sizeof(struct iq_block);
+    return &_block_ring;
+  }
+  *len = d->channelized ? _channel_block : _read_block;
+  return d->input;
+}
+
+/* demod_read_block would not wait */
+static int demod_block_ready(struct demod_state *d)
+{
+  uint32_t len;
+  struct spsc_ring *r = demod_input(d, &len);
+
+  return ring_used(r) >= len || ATOMIC_LOAD_ACQ(&r->closed);
+}
+
+/* next input block, either copied out of the input ring or a held
+ transfer buffer in zero-copy mode, or channel IQ of the filter bank
+ straight into lowpassed. returns 0 when exiting */
+static int demod_read_block(struct demod_state *d, struct iq_block *blk)
+{
+  uint32_t len;
+  struct spsc_ring *r = demod_input(d, &len);
+
+  while (!ring_wait(r, len, 100))
+  {
+    if ((d->exit_flag) || (_do_exit)) return 0;
+    /* end of offline input, take what is left in whole groups */
+    if (ATOMIC_LOAD_ACQ(&r->closed))
+    {
+      len = ring_used(r) & ~15u;
+      if (len == 0) return 0;
+      break;
+    }
+  }
+
+  if (dongle.zerocopy)
+  {
+    ring_read(r, blk, len);
+    d->buf = blk->buf;
+    /* filters work on whole groups of 8 IQ samples */
+    d->buf_len = blk->len & ~15u;
+    if (d->buf_len > MAXIMUM_BUF_LENGTH)
+      d->buf_len = MAXIMUM_BUF_LENGTH;
+  }
+  else if (d->channelized)
+  {
+    ring_read(r, d->lowpassed, len);
     d->buf_len = len;
-    pthread_rwlock_unlock(&d->rw);
+    d->lp_len = len / sizeof(float);
+  }
+  else
+  {
+    ring_read(r, d->buf_copy, len);
+    d->buf = d->buf_copy;
+    d->buf_len = len;
+  }
+
+  return 1;
+}
+
+static void demod_release_blocks(void)
+{
+  struct iq_block blk;
+
+  while (ring_used(&_block_ring) >= sizeof(blk))
+  {
+    ring_read(&_block_ring, &blk, sizeof(blk));
+    rtlsdr_release_buffer(dongle.dev, blk.buf);
+  }
+}
+
+/* rotate and convert input - very fast */
+static void demod_convert(struct demod_state *d)
+{
+  if (d->channelized)
+  {
+    /* the filter bank has done it, only a station off its grid is moved */
+    if (d->mixing)
+      mix_f32(&d->mix, d->lowpassed, d->lp_len);
+  }
+  else if (d->mixing)
+  {
+    mix_u8_f32(d);
+  }
+  else if (!d->offset_tuning)
+  {
+    rotate_90_u8_f32(d);
+  }
+  else
+  {
+    u8_f32(d);
+  }
+}
 
-    /* rotate and convert input - very fast */
-    if (!d->offset_tuning)
+/* level of the input block for the timeshift index, from every 16th IQ
+ sample. The channel IQ of the filter bank, or all of the capture */
+static void demod_level(struct demod_state *d)
+{
+  double p = 0.0;
+  float x, y;
+  uint32_t i, n = 0;
+
+  if (d->channelized)
+  {
+    for (i = 0; i + 1 < (uint32_t) d->lp_len; i += 32, n++)
+      p += d->lowpassed[i] * d->lowpassed[i] + d->lowpassed[i + 1] * d->lowpassed[i + 1];
+  }
+  else
+  {
+    for (i = 0; i + 1 < d->buf_len; i += 32, n++)
     {
-      rotate_90_u8_f32(d);
+      x = (d->buf[i] - 127.5f) / 128.0f;
+      y = (d->buf[i + 1] - 127.5f) / 128.0f;
+      p += x * x + y * y;
     }
-    else
+  }
+  d->level = (n && p > 1e-10 * n) ? (int) lrint(100.0 * log10(p / n)) : -1000;
+}
+
+/* both sides of an output buffer recheck their exit and eof flags */
+static void output_wake(struct output_state *s)
+{
+  pthread_mutex_lock(&s->ready_m);
+  pthread_cond_broadcast(&s->ready);
+  pthread_cond_broadcast(&s->room);
+  pthread_mutex_unlock(&s->ready_m);
+}
+
+/* result of d into the buffer of its output thread */
+static void demod_output(struct demod_state *d)
+{
+  struct output_state *o = d->output_target;
+  uint32_t len, n, had;
+
+  o->level = d->level;
+  len = d->result_len << 1;
+  /* offline input has no deadline, wait instead of dropping */
+  if (dongle.in_file)
+  {
+    pthread_mutex_lock(&o->ready_m);
+    while (o->buffer_size + len > o->buffer_size_max && !_do_exit)
+      pthread_cond_wait(&o->room, &o->ready_m);
+    pthread_mutex_unlock(&o->ready_m);
+  }
+  pthread_rwlock_wrlock(&o->rw);
+  had = o->buffer_size;
+  /* block lengths vary, split the copy where the buffer wraps */
+  n = o->buffer_size_max - o->buffer_wpos;
+  if (n > len) n = len;
+  memcpy(o->buffer + o->buffer_wpos, d->result, n);
+  memcpy(o->buffer, (char *) d->result + n, len - n);
+  o->buffer_wpos += len;
+  o->buffer_size += len;
+  /* begin new read with zero */
+  if (o->buffer_wpos >= o->buffer_size_max) o->buffer_wpos -= o->buffer_size_max;
+  /* already dropped some data, so print info */
+  if (o->buffer_size > o->buffer_size_max)
+  {
+    if (_beverbose)
+      fprintf(stderr, "dropping output buffer: %u B\n", o->buffer_size - o->buffer_size_max);
+    o->buffer_size = o->buffer_size_max;
+  }
+  pthread_rwlock_unlock(&o->rw);
+
+  /* the output thread only sleeps below a cluster, wake it once per cluster */
+  if (had < o->cluster && had + len >= o->cluster)
+  {
+    safe_cond_signal(&o->ready, &o->ready_m);
+  }
+}
+
+/* squelch, returns 1 if the block is not to be heard */
+static int demod_squelch(struct demod_state *d)
+{
+  if (d->squelch_level && d->squelch_hits > d->conseq_squelch)
+  {
+    d->squelch_hits = d->conseq_squelch + 1; /* hair trigger */
+    safe_cond_signal(&controller.hop, &controller.hop_m);
+    return 1;
+  }
+  return 0;
+}
+
+/* -P, up to jobs_len blocks are on the workers at once. The next block
+ is only waited for while nothing is in flight, otherwise the oldest
+ job is taken back first, so the pool adds no latency of its own */
+static void demod_pool_loop(struct demod_state *d)
+{
+  struct demod_job *j;
+  struct iq_block blk;
+  int head = 0, busy = 0, eof = 0;
+
+  while (!_do_exit)
+  {
+    if (!eof && busy < d->jobs_len && (busy == 0 || demod_block_ready(d)))
     {
-      u8_f32(d);
+      if (!demod_read_block(d, &blk))
+      {
+        eof = 1;
+        continue;
+      }
+      if (d->buf_len < 64)
+      {
+        if (dongle.zerocopy)
+          rtlsdr_release_buffer(dongle.dev, blk.buf);
+        continue;
+      }
+
+      j = &d->jobs[(head + busy) % d->jobs_len];
+      demod_job_start(d, j);
+      demod_level(d);
+      demod_convert(d);
+      if (dongle.zerocopy)
+        rtlsdr_release_buffer(dongle.dev, blk.buf);
+      demod_job_cut(d, j);
+      pool_submit(j);
+      busy++;
+      continue;
     }
+    if (busy == 0)
+      break;
 
-    /* wait for input data, demodulate - very slow */
-    full_demod(d);
+    j = &d->jobs[head];
+    pool_wait(j);
+    head = (head + 1) % d->jobs_len;
+    busy--;
+    demod_job_finish(d, j);
 
     if (d->exit_flag) {
       _do_exit = 1;
     }
+    if (!demod_squelch(d))
+      demod_output(d);
+  }
+
+  /* the workers may still be on some */
+  for (; busy > 0; busy--, head = (head + 1) % d->jobs_len)
+    pool_wait(&d->jobs[head]);
+}
+
+static void demod_loop(struct demod_state *d)
+{
+  struct iq_block blk;
+
+  while (!_do_exit)
+  {
+    if (!demod_read_block(d, &blk))
+      break;
 
-    /* squelch */
-    if (d->squelch_level && d->squelch_hits > d->conseq_squelch)
+    if (d->buf_len < 64)
     {
-      d->squelch_hits = d->conseq_squelch + 1; /* hair trigger */
-      safe_cond_signal(&controller.hop, &controller.hop_m);
+      if (dongle.zerocopy)
+        rtlsdr_release_buffer(dongle.dev, blk.buf);
       continue;
     }
 
-    /* output */
-    pthread_rwlock_wrlock(&o->rw);
-    len = d->result_len << 1;
-    if (_output_buffer_wpos + len <= _output_buffer_size_max)
-    {
-      memcpy(_output_buffer + _output_buffer_wpos, d->result, len);
-      _output_buffer_wpos += len;
-      _output_buffer_size += len;
-      /* begin new read with zero */
-      if (_output_buffer_wpos >= _output_buffer_size_max) _output_buffer_wpos = 0;
+    demod_level(d);
+    demod_convert(d);
+
+    /* input is converted, the USB buffer can go back */
+    if (dongle.zerocopy)
+      rtlsdr_release_buffer(dongle.dev, blk.buf);
+
+    /* wait for input data, demodulate - very slow */
+    full_demod(d);
+
+    if (d->exit_flag) {
+      _do_exit = 1;
     }
-    else
+
+    if (demod_squelch(d))
+      continue;
+
+    /* output */
+    demod_output(d);
+  }
+}
+
+static void * demod_thread_fn(void *arg)
+{
+  struct demod_state *d = arg;
+  struct output_state *o = d->output_target;
+
+  if (d->jobs)
+    demod_pool_loop(d);
+  else
+    demod_loop(d);
+
+  if (dongle.zerocopy)
+    demod_release_blocks();
+
+  if (ATOMIC_LOAD_ACQ(&dongle.eof))
+  {
+    ATOMIC_STORE_REL(&o->eof, 1);
+    output_wake(o);
+  }
+
+  return 0;
+}
+
+/* the most circbuffershift the history allows, in frames. One slot is
+ kept back from the oldest, the writer is about to reuse it */
+static int64_t output_shift_max(struct output_state *s)
+{
+  uint32_t depth = ts_depth(&s->ts);
+  int64_t max = depth > 1 ? (int64_t) (depth - 1) * (s->cluster / s->frame) : 0;
+
+  return max > INT32_MAX ? INT32_MAX : max;
+}
+
+/* ms > 0 towards live. The output thread and the pull callback pick the
+ new position up on their own and crossfade to it */
+static void output_seek(struct output_state *s, int ms)
+{
+  int64_t shift = s->circbuffershift - (int64_t) ms * s->rate / 1000;
+  int64_t max = output_shift_max(s);
+
+  if (shift > max) shift = max;
+  if (shift < 0) shift = 0;
+  s->circbuffershift = (int) shift;
+}
+
+/* byte position in the history that plays at circbuffershift */
+static uint64_t output_position(struct output_state *s)
+{
+  return (uint64_t) ATOMIC_LOAD_ACQ(&s->ts.written) * s->cluster -
+         (uint64_t) s->circbuffershift * s->frame;
+}
+
+/* to byte pos of the history, as far back as it goes */
+static void output_seek_pos(struct output_state *s, uint64_t pos)
+{
+  uint64_t live = (uint64_t) ATOMIC_LOAD_ACQ(&s->ts.written) * s->cluster;
+  int64_t shift = pos < live ? (int64_t) ((live - pos) / s->frame) : 0;
+  int64_t max = output_shift_max(s);
+
+  s->circbuffershift = (int) (shift > max ? max : shift);
+}
+
+/* byte position of the wall clock time ms, found in the tags of the
+ slots. -1 if the history starts after it */
+static int output_time_pos(struct output_state *s, int64_t ms, uint64_t *pos)
+{
+  struct ts_tag tag;
+  uint32_t n;
+  int64_t off;
+
+  if (ts_find(&s->ts, ms, &n) < 0 || ts_tag(&s->ts, n, &tag) < 0)
+    return -1;
+  off = ms - tag.ms < 1000000 ? (ms - tag.ms) * s->rate / 1000 : INT64_MAX;
+  /* in a gap of the input, or after the newest slot */
+  if (off >= s->cluster / s->frame)
+    *pos = ((uint64_t) n + 1) * s->cluster;
+  else
+    *pos = (uint64_t) n * s->cluster + (uint64_t) off * s->frame;
+  return 0;
+}
+
+static int output_seek_to(struct output_state *s, int64_t ms)
+{
+  uint64_t pos;
+
+  if (output_time_pos(s, ms, &pos) < 0)
+    return -1;
+  output_seek_pos(s, pos);
+  return 0;
+}
+
+/* slot and tag of what plays now, the time of day moved on to the
+ sample. -1 if the slot is gone */
+static int output_playing(struct output_state *s, uint32_t *n, struct ts_tag *tag)
+{
+  uint64_t pos = output_position(s);
+
+  *n = (uint32_t) (pos / s->cluster);
+  /* live is the end of the newest slot */
+  if (*n == ATOMIC_LOAD_ACQ(&s->ts.written))
+    (*n)--;
+  if (ts_tag(&s->ts, *n, tag) < 0)
+    return -1;
+  tag->ms += (int64_t) (pos - (uint64_t) *n * s->cluster) / s->frame * 1000 / s->rate;
+  return 0;
+}
+
+/* back to where the history of the frequency playing now starts */
+static void output_seek_station(struct output_state *s)
+{
+  struct ts_tag tag;
+  uint32_t n;
+
+  if (output_playing(s, &n, &tag) == 0)
+    output_seek_pos(s, (uint64_t) ts_freq_start(&s->ts, n) * s->cluster);
+}
+
+static void cursor_init(struct output_cursor *c)
+{
+  ts_reader_init(&c->r);
+  c->pos = 0;
+  c->shift = -1;
+  c->from = 0;
+  c->fade = 0;
+  c->mix = NULL;
+}
+
+static void cursor_free(struct output_state *s, struct output_cursor *c)
+{
+  ts_reader_free(&s->ts, &c->r);
+  free(c->mix);
+  cursor_init(c);
+}
+
+/* move c to pos, crossfading from where it is if fade */
+static void cursor_seek(struct output_state *s, struct output_cursor *c, uint64_t pos, int shift, int fade)
+{
+  if (fade)
+  {
+    c->from = c->pos;
+    c->fade = s->fade_frames;
+  }
+  c->pos = pos;
+  c->shift = shift;
+}
+
+/* len bytes from c on, the old position fading out under them */
+static void cursor_read(struct output_state *s, struct output_cursor *c, char *dst, uint32_t len)
+{
+  int16_t *to = (int16_t *) dst;
+  const int16_t *old = (const int16_t *) c->mix;
+  int channels = s->frame / 2;
+  uint32_t done = s->fade_frames - c->fade;
+  uint32_t n, i;
+  int32_t g;
+
+  ts_read(&s->ts, &c->r, c->pos, dst, len);
+  c->pos += len;
+  if (!c->fade)
+    return;
+  n = len / s->frame;
+  if (n > c->fade) n = c->fade;
+  ts_read(&s->ts, &c->r, c->from, c->mix, n * s->frame);
+  for (i = 0; i < n * channels; i++)
+  {
+    g = (int32_t) (((done + i / channels) << 15) / s->fade_frames);
+    to[i] = (int16_t) ((to[i] * g + old[i] * (32768 - g)) >> 15);
+  }
+  c->from += n * s->frame;
+  c->fade -= n;
+}
+
+/* end of offline input, hand out the last partial cluster and let
+ the audio device play out before exiting */
+static void output_drain(struct output_state *s)
+{
+  uint32_t n;
+
+  pthread_rwlock_rdlock(&s->rw);
+  while (s->buffer_size > 0)
+  {
+    n = s->buffer_size_max - s->buffer_rpos;
+    if (n > s->buffer_size) n = s->buffer_size;
+    if (s->play && _isStartStream && !_audio_muted && !_audio_pull)
+      SDL_QueueAudio(_audio_device, s->buffer + s->buffer_rpos, n);
+    if (s->filename != 0)
+      fwrite(s->buffer + s->buffer_rpos, sizeof(char), n, s->file);
+    s->buffer_rpos += n;
+    s->buffer_size -= n;
+    if (s->buffer_rpos >= s->buffer_size_max) s->buffer_rpos = 0;
+  }
+  pthread_rwlock_unlock(&s->rw);
+
+  /* a partial slot is never published, the callback stops at the last whole one */
+  while (s->play && _isStartStream && !_audio_muted && !_do_exit &&
+         (_audio_pull ? s->pull.pos < (uint64_t) ATOMIC_LOAD_ACQ(&s->ts.written) * s->cluster
+                      : SDL_GetQueuedAudioSize(_audio_device) > 0))
+    usleep(10000);
+
+  ATOMIC_STORE_REL(&s->drained, 1);
+}
+
+/* IQ waiting for the demodulator, audio waiting for the output thread,
+ queued bytes ahead of the device and the device buffer, in ms */
+static uint32_t output_latency(struct output_state *s, uint64_t queued)
+{
+  uint32_t rate = (uint32_t) s->rate * (uint32_t) s->frame;
+  uint32_t ms;
+
+  ms = (uint32_t) ((queued + s->buffer_size) * 1000 / rate);
+  if (!dongle.zerocopy && !_pfb.active)
+    ms += (uint32_t) ((uint64_t) ring_used(&_input_ring) * 1000 / (dongle.rate * 2));
+  ms += (uint32_t) _audio_device_samples * 1000 / (uint32_t) s->rate;
+  s->latency_ms = ms;
+  return ms;
+}
+
+/* -E pull, SDL asks for the next period and gets it straight out of the
+ timeshift ring. It plays PULL_LEAD slots behind the newest one written,
+ less the timeshift, and crossfades there on a seek or once it is late */
+static void SDLCALL output_audio_pull(void *userdata, Uint8 *stream, int len)
+{
+  struct output_state *s = userdata;
+  uint32_t written = ATOMIC_LOAD_ACQ(&s->ts.written);
+  uint64_t end = (uint64_t) written * s->cluster;
+  int64_t max = output_shift_max(s) - (int64_t) PULL_LEAD * (s->cluster / s->frame);
+  uint64_t back, target, n;
+  int shift = s->circbuffershift;
+
+  if (shift > max) shift = (int) max;
+  if (shift < 0) shift = 0;
+  back = (uint64_t) shift * s->frame + (uint64_t) PULL_LEAD * s->cluster;
+  if (end < back)
+  {
+    /* not enough audio for the lead yet */
+    memset(stream, 0, len);
+    return;
+  }
+  target = end - back;
+  if (shift != s->pull.shift || s->pull.pos > end ||
+      s->pull.pos + (uint64_t) PULL_SLACK * s->cluster < target)
+    cursor_seek(s, &s->pull, target, shift, s->pull.shift >= 0);
+
+  while (len > 0)
+  {
+    n = end - s->pull.pos;
+    if (n == 0)
     {
-      /* buffer_size_max must be multiple of len */
-      memcpy(_output_buffer, d->result, len);
-      _output_buffer_wpos = len;
-      _output_buffer_size += len;
+      /* underrun, the demodulator is late */
+      memset(stream, 0, len);
+      break;
     }
-    /* already dropped some data, so print info */
-    if (_output_buffer_size > _output_buffer_size_max)
+    if (n > (uint64_t) len) n = (uint64_t) len;
+    cursor_read(s, &s->pull, (char *) stream, (uint32_t) n);
+    stream += n;
+    len -= (int) n;
+  }
+
+  output_latency(s, end - s->pull.pos);
+}
+
+/* after a retune or unmuting the queued audio is stale. Seeks keep it,
+ the new position is crossfaded in behind it */
+static void audio_seeked(void)
+{
+  if (!_audio_pull && SDL_GetQueuedAudioSize(_audio_device) > output.cluster * 5)
+    SDL_ClearQueuedAudio(_audio_device);
+}
+
+/* -E lowlat, keeps the audio device queue near LOWLAT_TARGET_MS. A
+ cluster is left out while the queue runs long, silence refills it after
+ an underrun. Returns what SDL_QueueAudio returned */
+static int output_queue_bounded(struct output_state *s, const char *buf)
+{
+  uint32_t queued, target, rate, ms;
+  int r = 0, i;
+
+  rate = (uint32_t) s->rate * (uint32_t) s->frame;
+  target = (uint32_t) ((uint64_t) rate * LOWLAT_TARGET_MS / 1000);
+  queued = SDL_GetQueuedAudioSize(_audio_device);
+  if (queued > target + 2 * s->cluster)
+  {
+    s->trimmed++;
+  }
+  else
+  {
+    if (queued == 0)
     {
-      if (_beverbose)
-        fprintf(stderr, "dropping output buffer: %u B\n", _output_buffer_size - _output_buffer_size_max);
-      _output_buffer_size = _output_buffer_size_max;
+      for (i = 0; i < LOWLAT_PAD && r == 0; i++)
+        r = SDL_QueueAudio(_audio_device, s->silence, s->cluster);
+      queued += LOWLAT_PAD * s->cluster;
+      s->padded++;
     }
-    pthread_rwlock_unlock(&o->rw);
-    
+    if (r == 0)
+      r = SDL_QueueAudio(_audio_device, buf, s->cluster);
+    queued += s->cluster;
   }
 
-  return 0;
+  ms = output_latency(s, queued);
+
+  /* once a second, only the played channel comes here */
+  if (_beverbose && ++s->reports * LOWLAT_CLUSTER_MS >= 1000)
+  {
+    s->reports = 0;
+    fprintf(stderr, "latency %u ms, %u clusters trimmed, %u underruns\n", ms, s->trimmed, s->padded);
+  }
+  return r;
+}
+
+/* sleep until len bytes are buffered. 0 at exit or once an offline
+ input has ended with less than that left */
+static int output_wait(struct output_state *s, uint32_t len)
+{
+  int ok;
+
+  pthread_mutex_lock(&s->ready_m);
+  while (s->buffer_size < len && !_do_exit && !ATOMIC_LOAD_ACQ(&s->eof))
+    pthread_cond_wait(&s->ready, &s->ready_m);
+  ok = s->buffer_size >= len;
+  pthread_mutex_unlock(&s->ready_m);
+  return ok;
 }
 
 static void * output_thread_fn(void *arg)
 {
-  int circbufferbotton;
-  int circbufferout;
-  int shiftmin;
-  int shiftmax;
+  uint64_t target;
+  int shift;
   int SentNum;
-  int circbufferfull;
+  struct ts_tag tag;
   struct output_state *s = arg;
 
 
-  circbufferbotton=0;
-  circbufferout=0;
-  circbufferfull=0;
-  shiftmin=0;
-  shiftmax=0;
   SentNum=0;
 
   while (!_do_exit)
   {
-    while (_output_buffer_size < CIRCBUFFCLUSTER)
+    if (!output_wait(s, s->cluster))
     {
-      if (_do_exit) return 0;
-      usleep(5000);
+      if (!_do_exit)
+        output_drain(s);
+      return 0;
     }
 
 
     /* copy block to circular buffer */
     pthread_rwlock_rdlock(&s->rw);
-    memcpy(_circbuffer+(circbufferbotton*CIRCBUFFCLUSTER), _output_buffer + _output_buffer_rpos, CIRCBUFFCLUSTER);
-    _output_buffer_rpos += CIRCBUFFCLUSTER;
-    _output_buffer_size -= CIRCBUFFCLUSTER;
-    if (_output_buffer_rpos >= _output_buffer_size_max) _output_buffer_rpos = 0;
+    memcpy(ts_next(&s->ts), s->buffer + s->buffer_rpos, s->cluster);
+    s->buffer_rpos += s->cluster;
+    s->buffer_size -= s->cluster;
+    if (s->buffer_rpos >= s->buffer_size_max) s->buffer_rpos = 0;
     pthread_rwlock_unlock(&s->rw);
+    /* an offline demodulator may be waiting for the space */
+    if (dongle.in_file)
+    {
+      safe_cond_signal(&s->room, &s->ready_m);
+    }
 
     if (_isStartStream)
     {
-      if (circbufferfull==0)
-        shiftmin=0;
-      else {
-        shiftmin = circbufferbotton+1;
-        if (shiftmin >= _circbufferslots) {
-          shiftmin=0;
-        }
-      }
-      shiftmax=circbufferbotton;
-
-      if (_circbuffeshift < 0) _circbuffeshift=0;
-
       /* max shift time available */
-      if (circbufferfull==0) {
-        if (_circbuffeshift > circbufferbotton)
-          _circbuffeshift=circbufferbotton;
-      } else {
-        if (_circbuffeshift > (_circbufferslots-2))
-          _circbuffeshift = (_circbufferslots-2);
-      }
-
-      /* calculate circular buffer playback position */
-      circbufferout = (circbufferbotton-_circbuffeshift);
-      if (circbufferout < 0) {
-        circbufferout  = _circbufferslots - (_circbuffeshift-circbufferbotton);
-      }
-
-      if (!_audio_muted) {
-        SentNum = SDL_QueueAudio(_audio_device, _circbuffer+(circbufferout*CIRCBUFFCLUSTER), CIRCBUFFCLUSTER);
+      if (s->circbuffershift < 0) s->circbuffershift=0;
+      if (s->circbuffershift > output_shift_max(s))
+        s->circbuffershift = (int) output_shift_max(s);
+      shift = s->circbuffershift;
+
+      /* playback position, the slot being written is number ts.written */
+      target = (uint64_t) s->ts.written * s->cluster - (uint64_t) shift * s->frame;
+      if (target != s->cur.pos)
+        cursor_seek(s, &s->cur, target, shift, 1);
+      cursor_read(s, &s->cur, s->played, s->cluster);
+
+      if (s->play && !_audio_muted && !_audio_pull) {
+        if (_low_latency)
+          SentNum = output_queue_bounded(s, s->played);
+        else
+          SentNum = SDL_QueueAudio(_audio_device, s->played, s->cluster);
       }
 
-      if (output.filename!=0) {
-        fwrite (_circbuffer+(circbufferout*CIRCBUFFCLUSTER) , sizeof(char), CIRCBUFFCLUSTER, output.file);
+      if (s->filename!=0) {
+        fwrite (s->played, sizeof(char), s->cluster, s->file);
       }
 
-      if (++circbufferbotton >= _circbufferslots) {
-        circbufferfull=1;
-        circbufferbotton=0;
-      }
+      /* the slot started a cluster ago, its tags must not go back
+       whatever the clock does */
+      tag.ms = (int64_t) (time_now() * 1000.0) - (int64_t) (s->cluster / s->frame) * 1000 / s->rate;
+      if (tag.ms < s->tagged_ms)
+        tag.ms = s->tagged_ms;
+      s->tagged_ms = tag.ms;
+      tag.freq = s->freq;
+      tag.level = (int16_t) s->level;
+      /* complete for the audio callback, and out to the spill file */
+      if (ts_commit(&s->ts, &tag) < 0 && _beverbose)
+        fprintf(stderr, "Can't map the timeshift file, only the last %d slots are kept\n", s->ts.hot_slots);
 
       
       if (SentNum != 0) {
         fprintf(stderr, "Error sending stream: \"%s\". Close the connection!\n", SDL_GetError() );
         _isStartStream = false;
         /* Stop reading samples from dongle */
-        rtlsdr_cancel_async(dongle.dev);
+        dongle.source->cancel(&dongle);
         pthread_join(dongle.thread, NULL);
         fprintf(stderr,"Press [X] to exit");
       }
@@ -1022,15 +1743,86 @@ static void * output_thread_fn(void *arg)
 
   } /* _do_exit */
 
-  if (_isStartStream) {
-    _isStartStream=false;
+  if (_isStartStream) {
+    _isStartStream=false;
+  }
+
+  return 0;
+}
+
+
+
+/* one capture for every station of -C: centered between them but at
+ least CHANNEL_DC_GAP away from each, at the lowest rate that keeps all
+ of them CHANNEL_EDGE inside the band. the filter bank needs the center
+ on its channel grid and a power of two of channels. returns -1 if the
+ stations don't fit */
+#define CHANNEL_DC_GAP			50000
+#define CHANNEL_EDGE			100000
+#define CHANNEL_MAX_RATE		3200000
+
+static int channel_settings(void)
+{
+  struct dongle_state *d = &dongle;
+  struct demod_state *dm = &demod;
+  int64_t f[CHANNELS_LIMIT + 1];
+  int64_t lo, hi, mid, grid, center, offset, near, far, best_near = -1, best = 0;
+  int i, n, step;
+
+  n = 0;
+  f[n++] = controller.freqs[controller.freq_len-1];
+  for (i = 0; i < _channel_count; i++)
+    f[n++] = _channels[i]->freq;
+
+  lo = hi = f[0];
+  for (i = 1; i < n; i++) {
+    if (f[i] < lo) lo = f[i];
+    if (f[i] > hi) hi = f[i];
+  }
+
+  /* try the middle first, then grid steps to either side */
+  mid = (lo + hi) / 2;
+  grid = 25000;
+  if (_pfb.active) {
+    grid = dm->rate_in / 2;
+    mid = f[0] + llround((double) (mid - f[0]) / (double) grid) * grid;
+  }
+  for (step = 0; step <= 8; step++)
+  {
+    offset = ((step + 1) / 2) * grid * ((step & 1) ? 1 : -1);
+    center = mid + offset;
+    near = CHANNEL_DC_GAP;
+    for (i = 0; i < n; i++) {
+      if (llabs(f[i] - center) < near)
+        near = llabs(f[i] - center);
+    }
+    if (near > best_near) {
+      best_near = near;
+      best = center;
+    }
+    if (near >= CHANNEL_DC_GAP)
+      break;
+  }
+
+  far = (hi - best > best - lo) ? hi - best : best - lo;
+  for (dm->downsample = 8; dm->downsample <= MAXIMUM_OVERSAMPLE; dm->downsample++)
+  {
+    if ((int64_t) dm->downsample * dm->rate_in > CHANNEL_MAX_RATE)
+      return -1;
+    if (_pfb.active && (dm->downsample & (dm->downsample - 1)))
+      continue;
+    if ((int64_t) dm->downsample * dm->rate_in / 2 - CHANNEL_EDGE >= far)
+      break;
   }
+  if (dm->downsample > MAXIMUM_OVERSAMPLE)
+    return -1;
 
+  dm->output_scale = 1;
+  d->freq = (uint32_t) best;
+  d->rate = (uint32_t) (dm->downsample * dm->rate_in);
   return 0;
 }
 
-
-
 static void optimal_settings(int freq, int rate)
 {
   /* giant ball of hacks
@@ -1040,6 +1832,10 @@ static void optimal_settings(int freq, int rate)
   struct demod_state *dm = &demod;
   struct controller_state *cs = &controller;
 
+  /* channel_settings() has placed the capture already */
+  if (_channel_count)
+    return;
+
 
   dm->downsample = 8;
 
@@ -1079,7 +1875,11 @@ static void * controller_thread_fn(void *arg)
   }
 
   /* Set the frequency */
-  if (_beverbose) {
+  if (!dongle.dev) {
+    /* offline input, the capture has to match these */
+    if (_beverbose)
+      fprintf(stderr, "Reading %s, expecting %u Hz captured at %u S/s.\n", dongle.in_name, dongle.freq, dongle.rate);
+  } else if (_beverbose) {
     verbose_set_frequency(dongle.dev, dongle.freq);
     fprintf(stderr, "Oversampling input by: %ix.\n", demod.downsample);
     fprintf(stderr, "Oversampling output by: %ix.\n", demod.post_downsample);
@@ -1090,12 +1890,14 @@ static void * controller_thread_fn(void *arg)
   }
    
   /* Set the sample rate */
-  if (_beverbose) {
-    verbose_set_sample_rate(dongle.dev, dongle.rate);
-    fprintf(stderr, "Output at %u Hz.\n", demod.rate_in/demod.post_downsample);
-  } else {
-    if ( rtlsdr_set_sample_rate(dongle.dev, dongle.rate) < 0 )
-      fprintf(stderr, "WARNING: Failed to set sample rate.\n");
+  if (dongle.dev) {
+    if (_beverbose) {
+      verbose_set_sample_rate(dongle.dev, dongle.rate);
+      fprintf(stderr, "Output at %u Hz.\n", demod.rate_in/demod.post_downsample);
+    } else {
+      if ( rtlsdr_set_sample_rate(dongle.dev, dongle.rate) < 0 )
+        fprintf(stderr, "WARNING: Failed to set sample rate.\n");
+    }
   }
 
   while (!_do_exit) {
@@ -1106,6 +1908,7 @@ static void * controller_thread_fn(void *arg)
     s->freq_now = (s->freq_now + 1) % s->freq_len;
     optimal_settings(s->freqs[s->freq_now], demod.rate_in);
     rtlsdr_set_center_freq(dongle.dev, dongle.freq);
+    output.freq = s->freqs[s->freq_now];
     dongle.mute = BUFFER_DUMP;
   }
   return 0;
@@ -1150,22 +1953,33 @@ void dongle_init(struct dongle_state *s)
   s->gain = AUTO_GAIN; /* tenths of a dB */
   s->mute = 0;
   s->direct_sampling = 0;
+  s->zerocopy = 0;
   s->demod_target = &demod;
+  s->source = &input_dongle;
+  s->in_name = NULL;
+  s->in_file = NULL;
+  s->pace = 0;
+  s->eof = 0;
 }
 
 void demod_init(struct demod_state *s)
 {
+  s->arena = NULL;
+  s->buf = s->buf_copy = NULL;
+  s->lowpassed = s->work = NULL;
+  s->result = NULL;
   s->rate_in = DEFAULT_SAMPLE_RATE;
   s->rate_out = DEFAULT_SAMPLE_RATE;
   s->squelch_level = 0;
   s->conseq_squelch = 10;
   s->terminate_on_squelch = 0;
   s->squelch_hits = 11;
+  s->level = -1000;
   s->downsample_passes = 0;
   s->comp_fir_size = 0;
   s->prev_index = 0;
   s->post_downsample = 1;  /* once this works, default = 4 */
-  s->custom_atan = 1;
+  s->custom_atan = ATAN_FAST;
   s->deemph = DEEMPHASIS_FM_EU;
   s->offset_tuning = 0;
   s->rate_out2 = 48000;
@@ -1180,14 +1994,24 @@ void demod_init(struct demod_state *s)
   s->deemph_r_f32 = 0;
   s->volume = 0.4f;
   s->now_lpr = 0;
+  s->lp_taps = 32;
+  s->multipass = 0;
+  s->mixing = 0;
+  s->channelized = 0;
+  s->input = &_input_ring;
+  s->jobs = NULL;
+  s->jobs_len = 0;
+  s->decim.coef = NULL;
+  s->decim.line = NULL;
   s->lpr.mode = 2;
-  s->lpr.size = 90; /* RPI can do only 90, 128 is optimal */
+  s->lpr.size = 128;
   s->lpr.br = NULL;
-  s->lpr.bm = NULL;
-  s->lpr.bs = NULL;
+  s->lpr.bms = NULL;
   s->lpr.fm = NULL;
   s->lpr.fp = NULL;
   s->lpr.fs = NULL;
+  s->lpr.ob = NULL;
+  s->lpr.rs.coef = NULL;
   pthread_rwlock_init(&s->rw, NULL);
   pthread_cond_init(&s->ready, NULL);
   pthread_mutex_init(&s->ready_m, NULL);
@@ -1196,6 +2020,10 @@ void demod_init(struct demod_state *s)
 
 void demod_cleanup(struct demod_state *s)
 {
+  deinit_demod_jobs(s);
+  deinit_decimator_f32(&s->decim);
+  deinit_lp_real_f32(s);
+  deinit_demod_arena(s);
   pthread_rwlock_destroy(&s->rw);
   pthread_cond_destroy(&s->ready);
   pthread_mutex_destroy(&s->ready_m);
@@ -1204,18 +2032,169 @@ void demod_cleanup(struct demod_state *s)
 void output_init(struct output_state *s)
 {
   s->rate = 48000;
+  s->eof = 0;
+  s->play = 0;
+  s->drained = 0;
+  s->file = NULL;
+  s->filename = 0;
+  s->buffer = NULL;
+  s->buffer_rpos = 0;
+  s->buffer_wpos = 0;
+  s->buffer_size = 0;
+  s->buffer_size_max = 0;
+  ts_init(&s->ts);
+  cursor_init(&s->cur);
+  cursor_init(&s->pull);
+  s->played = NULL;
+  s->freq = 0;
+  s->level = -1000;
+  s->tagged_ms = 0;
+  s->fade_frames = 0;
+  s->circbufferslots = 0;
+  s->circbuffershift = 0;
+  s->cluster = CIRCBUFFCLUSTER;
+  s->silence = NULL;
+  s->frame = 4;
+  s->latency_ms = 0;
+  s->trimmed = 0;
+  s->padded = 0;
+  s->reports = 0;
   pthread_rwlock_init(&s->rw, NULL);
   pthread_cond_init(&s->ready, NULL);
+  pthread_cond_init(&s->room, NULL);
   pthread_mutex_init(&s->ready_m, NULL);
 }
 
+/* demodulator buffer for the rate and kbytes of timeshift, kept in RAM
+ or, with a spill file, mostly on disk */
+int output_alloc(struct output_state *s, int64_t kbytes, const char *spill)
+{
+  s->buffer_size_max = (uint32_t) (OUTPUT_BUFFER_SECONDS * s->rate * 2 * sizeof(int16_t));
+  s->frame = demod.lpr.mode == 2 ? 4 : 2;
+  s->cluster = CIRCBUFFCLUSTER;
+  if (_low_latency)
+  {
+    s->cluster = (uint32_t) (s->rate * LOWLAT_CLUSTER_MS / 1000) * s->frame;
+    s->silence = calloc(1, s->cluster);
+    if (!s->silence)
+      return -1;
+  }
+  s->buffer_size_max = (s->buffer_size_max / s->cluster + 1) * s->cluster;
+  s->circbuffershift = 0;
+  s->buffer = malloc(s->buffer_size_max);
+  if (!s->buffer ||
+      ts_open(&s->ts, s->cluster, (int) ((kbytes * 1024) / s->cluster), spill,
+              _ts_compress ? s->frame : 0) < 0)
+    return -1;
+  s->circbufferslots = s->ts.slots;
+  s->fade_frames = (uint32_t) (s->rate * SEEK_FADE_MS / 1000);
+  s->played = malloc(s->cluster);
+  s->cur.mix = malloc(s->fade_frames * s->frame);
+  s->pull.mix = malloc(s->fade_frames * s->frame);
+  if (!s->played || !s->cur.mix || !s->pull.mix)
+    return -1;
+  return 0;
+}
+
 void output_cleanup(struct output_state *s)
 {
+  free(s->buffer);
+  free(s->silence);
+  s->buffer = NULL;
+  s->silence = NULL;
+  free(s->played);
+  s->played = NULL;
+  cursor_free(s, &s->cur);
+  cursor_free(s, &s->pull);
+  ts_close(&s->ts);
   pthread_rwlock_destroy(&s->rw);
   pthread_cond_destroy(&s->ready);
+  pthread_cond_destroy(&s->room);
   pthread_mutex_destroy(&s->ready_m);
 }
 
+/* -C station, a copy of the main demodulator reading its own ring.
+ called once the options are final and before any filter is set up */
+static struct channel_state *channel_new(uint32_t freq)
+{
+  struct channel_state *c;
+
+  c = malloc(sizeof(*c));
+  if (!c)
+    return NULL;
+  /* the ring is sized in main once the rates are known */
+  c->ring_buf = NULL;
+  c->freq = freq;
+  c->filename[0] = 0;
+
+  c->demod = demod;
+  c->demod.input = &c->ring;
+  c->demod.output_target = &c->output;
+  pthread_rwlock_init(&c->demod.rw, NULL);
+  pthread_cond_init(&c->demod.ready, NULL);
+  pthread_mutex_init(&c->demod.ready_m, NULL);
+
+  output_init(&c->output);
+  c->output.rate = output.rate;
+  c->output.freq = freq;
+  if (output_alloc(&c->output, CHANNEL_TIMESHIFT, NULL) < 0) {
+    output_cleanup(&c->output);
+    free(c);
+    return NULL;
+  }
+
+  return c;
+}
+
+static void channel_free(struct channel_state *c)
+{
+  demod_cleanup(&c->demod);
+  output_cleanup(&c->output);
+  ring_cleanup(&c->ring);
+  free(c->ring_buf);
+  free(c);
+}
+
+/* puts a demodulator on the filter bank channel nearest to freq */
+static int pfb_add(struct demod_state *d, uint32_t freq, struct spsc_ring *r)
+{
+  int spacing = (int) dongle.rate / _pfb.bank.nch;
+  int off = (int) freq - (int) dongle.freq;
+  int k = (int) lrint((double) off / (double) spacing);
+  float *ob;
+
+  ob = malloc(PFB_BLOCK * 2 * sizeof(float));
+  if (!ob)
+    return -1;
+  _pfb.bins[_pfb.nbins] = k & (_pfb.bank.nch - 1);
+  _pfb.out[_pfb.nbins] = r;
+  _pfb.ob[_pfb.nbins] = ob;
+  _pfb.nbins++;
+
+  d->channelized = 1;
+  d->input = r;
+  d->mixing = off != k * spacing;
+  if (d->mixing) {
+    fprintf(stderr, "%u Hz is off the %d Hz channel grid, its audio will suffer\n", freq, spacing);
+    init_mixer_f32(&d->mix, off - k * spacing, d->rate_in);
+  }
+  return 0;
+}
+
+/* offline input is done once every channel has written its last sample */
+static int outputs_drained(void)
+{
+  int i;
+
+  if (!ATOMIC_LOAD_ACQ(&output.drained))
+    return 0;
+  for (i = 0; i < _channel_count; i++) {
+    if (!ATOMIC_LOAD_ACQ(&_channels[i]->output.drained))
+      return 0;
+  }
+  return 1;
+}
+
 void controller_init(struct controller_state *s)
 {
   s->freqs[0] = 100000000;
@@ -1283,10 +2262,34 @@ void CloseWaveOut(FILE * file)
 
 }
 
-FILE * InitWaveOut(char * newfile, int mode)
+/* sizeof(_WAVHeaderStereo) bytes, the sizes are fixed by CloseWaveOut */
+static void WaveHeader(char * header, int mode, int rate)
+{
+  int byterate;
+
+  if (mode==2) {  
+    memcpy(header, _WAVHeaderStereo, sizeof(_WAVHeaderStereo)); /* STEREO WAV header */
+    byterate = rate * 4;
+  } else {
+    memcpy(header, _WAVHeaderMono, sizeof(_WAVHeaderMono)); /* MONO WAV header */
+    byterate = rate * 2;
+  }
+  /* sample rate and byte rate, little endian */
+  header[24] = rate & 0xff;
+  header[25] = (rate >> 8) & 0xff;
+  header[26] = (rate >> 16) & 0xff;
+  header[27] = (rate >> 24) & 0xff;
+  header[28] = byterate & 0xff;
+  header[29] = (byterate >> 8) & 0xff;
+  header[30] = (byterate >> 16) & 0xff;
+  header[31] = (byterate >> 24) & 0xff;
+}
+
+FILE * InitWaveOut(char * newfile, int mode, int rate)
 {
   FILE *file;
   size_t written;
+  char header[sizeof(_WAVHeaderStereo)];
 
   /* write WAV output to file */
   if (newfile ==0) {
@@ -1308,18 +2311,11 @@ FILE * InitWaveOut(char * newfile, int mode)
         return NULL;
       }
     }
-    if (mode==2) {  
-      written = fwrite(_WAVHeaderStereo , sizeof(char), sizeof(_WAVHeaderStereo), file); /* write STEREO WAV header */
-      if (written != sizeof(_WAVHeaderStereo)) {
-        fclose(file);
-        return NULL;
-      }
-    } else {
-      written = fwrite(_WAVHeaderMono , sizeof(char), sizeof(_WAVHeaderMono), file); /* write MONO WAV header */
-      if (written != sizeof(_WAVHeaderMono)) {
-        fclose(file);
-        return NULL;
-      }
+    WaveHeader(header, mode, rate);
+    written = fwrite(header, sizeof(char), sizeof(header), file);
+    if (written != sizeof(header)) {
+      fclose(file);
+      return NULL;
     }
     
     return file;
@@ -1327,6 +2323,194 @@ FILE * InitWaveOut(char * newfile, int mode)
 
 }
 
+/* hh:mm[:ss] typed after question, the last time of day it was, in ms
+ since the epoch. typed keeps what was typed, 9 bytes. -1 if it is not
+ a time */
+static int read_clock(const char *question, char *typed, int64_t *ms)
+{
+  struct tm *timeinfo;
+  time_t now, when;
+  int key, len = 0;
+
+  printf("                                                  \r"); /* clear this line */
+  printf("%s", question);
+  do {
+    key = _getch();
+    if ( ((key >= '0') && (key <= '9')) || (key == ':') ) {
+      typed[len++] = key;
+      printf("%c", key);
+    } else if ( (key==27) || (key==13) || (key==10) || (key==EOF) ) {
+      key = 255;
+    }
+  } while ( (key!=255) && (len<8) );
+  typed[len] = 0;
+  printf("\r");
+
+  /* today, or yesterday if that is still to come */
+  time(&now);
+  timeinfo = localtime(&now);
+  timeinfo->tm_sec = 0;
+  if (sscanf(typed, "%d:%d:%d", &timeinfo->tm_hour, &timeinfo->tm_min, &timeinfo->tm_sec) < 2)
+    return -1;
+  when = mktime(timeinfo);
+  if (when > now)
+    when -= 24 * 60 * 60;
+  *ms = (int64_t) when * 1000;
+  return 0;
+}
+
+/* copies out what the timeshift reuses within EXPORT_GUARD_MS, and at
+ least the rest of the chunk it is at, then writes that chunk. A byte
+ is in the stage at its file offset modulo cap, the header first */
+static void * export_thread_fn(void *arg)
+{
+  struct wav_export *e = arg;
+  struct output_state *s = e->s;
+  uint64_t hdr = sizeof(_WAVHeaderStereo);
+  uint64_t guard = (uint64_t) EXPORT_GUARD_MS * s->rate / 1000 * s->frame;
+  uint64_t first, want, end, at, room;
+  uint32_t n;
+  size_t len;
+  int err = 0;
+
+  while (e->done < e->len && !_do_exit)
+  {
+    end = ((hdr + e->done) / EXPORT_CHUNK + 1) * EXPORT_CHUNK - hdr;
+    if (end > e->len) end = e->len;
+    first = (uint64_t) ATOMIC_LOAD_ACQ(&s->ts.written) * s->cluster -
+            (uint64_t) output_shift_max(s) * s->frame;
+    want = first + guard > e->from ? first + guard - e->from : 0;
+    if (want < end) want = end;
+    if (want > e->len) want = e->len;
+    /* not over the chunk still to be written */
+    at = e->done ? hdr + e->done : 0;
+    room = at + e->cap - hdr;
+    if (want > room) want = room;
+    while (e->staged < want)
+    {
+      at = (hdr + e->staged) % e->cap;
+      n = (uint32_t) (want - e->staged < e->cap - at ? want - e->staged : e->cap - at);
+      e->lost += ts_read(&s->ts, &e->r, e->from + e->staged, e->stage + at, n);
+      e->staged += n;
+    }
+
+    at = e->done ? hdr + e->done : 0;
+    len = (size_t) (hdr + end - at);
+    if (fwrite(e->stage + at % e->cap, 1, len, e->file) != len)
+    {
+      /* closing the file may change it */
+      err = errno;
+      e->failed = 1;
+      break;
+    }
+    e->done = end;
+    e->percent = (int) (e->done * 100 / e->len);
+  }
+
+  CloseWaveOut(e->file);
+  e->file = NULL;
+  ts_reader_free(&s->ts, &e->r);
+  dsp_free(e->stage);
+  e->stage = NULL;
+  if (e->failed)
+    fprintf(stderr, "\nError writing %s: %s\n", e->filename, strerror(err));
+  else if (e->lost)
+    fprintf(stderr, "\nExported %s, %u s of it were already gone\n", e->filename,
+            (unsigned) (e->lost / s->frame / s->rate));
+  else if (!_do_exit)
+    printf("\nExported %s\n", e->filename);
+  ATOMIC_STORE_REL(&e->active, 0);
+  return 0;
+}
+
+void export_init(struct wav_export *e)
+{
+  e->active = 0;
+  e->s = NULL;
+  e->file = NULL;
+  e->stage = NULL;
+}
+
+/* waits for the export thread, at exit it stops early and closes the
+ file with what it has */
+void export_stop(struct wav_export *e)
+{
+  if (!e->s)
+    return;
+  pthread_join(e->thread, NULL);
+  e->s = NULL;
+}
+
+/* the history from wall clock time from_ms to to_ms, as far back as it
+ goes, to a WAV file named for when it starts. -1 if none of it is
+ there, an export is still running or the file can't be made */
+int export_start(struct wav_export *e, struct output_state *s, int64_t from_ms, int64_t to_ms)
+{
+  uint64_t live = (uint64_t) ATOMIC_LOAD_ACQ(&s->ts.written) * s->cluster;
+  uint64_t first = live - (uint64_t) output_shift_max(s) * s->frame;
+  uint64_t hdr = sizeof(_WAVHeaderStereo);
+  uint64_t from, to, cap;
+  struct ts_tag tag;
+  time_t start;
+
+  if (ATOMIC_LOAD_ACQ(&e->active))
+    return -1;
+  export_stop(e);
+
+  if (output_time_pos(s, to_ms, &to) < 0)
+    return -1;
+  if (to > live)
+    to = live;
+  if (output_time_pos(s, from_ms, &from) < 0 || from < first)
+  {
+    from = first;
+    if (ts_tag(&s->ts, (uint32_t) (first / s->cluster), &tag) == 0)
+      from_ms = tag.ms;
+  }
+  if (from >= to)
+    return -1;
+
+  /* the guard, a chunk being written and one being filled */
+  cap = ((uint64_t) EXPORT_GUARD_MS * s->rate / 1000 * s->frame / EXPORT_CHUNK + 2) * EXPORT_CHUNK;
+  if (cap > (hdr + to - from + EXPORT_CHUNK - 1) / EXPORT_CHUNK * EXPORT_CHUNK)
+    cap = (hdr + to - from + EXPORT_CHUNK - 1) / EXPORT_CHUNK * EXPORT_CHUNK;
+  e->cap = (uint32_t) cap;
+  e->stage = dsp_alloc(e->cap);
+  start = (time_t) (from_ms / 1000);
+  strftime(e->filename, sizeof(e->filename), "FMexport_%Y-%m-%d_%H-%M-%S.wav", localtime(&start));
+  e->file = e->stage ? fopen(e->filename, "wb") : NULL;
+  if (!e->file)
+  {
+    dsp_free(e->stage);
+    e->stage = NULL;
+    return -1;
+  }
+  /* the chunks go to the file as they are */
+  setvbuf(e->file, NULL, _IONBF, 0);
+  WaveHeader(e->stage, s->frame == 4 ? 2 : 1, s->rate);
+
+  e->s = s;
+  e->from = from;
+  e->len = to - from;
+  e->staged = 0;
+  e->done = 0;
+  e->percent = 0;
+  e->lost = 0;
+  e->failed = 0;
+  ts_reader_init(&e->r);
+  e->active = 1;
+  if (pthread_create(&e->thread, NULL, export_thread_fn, e) != 0)
+  {
+    e->active = 0;
+    e->s = NULL;
+    fclose(e->file);
+    e->file = NULL;
+    dsp_free(e->stage);
+    e->stage = NULL;
+    return -1;
+  }
+  return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -1339,14 +2523,31 @@ int main(int argc, char **argv)
   int dev_given = 0;
   int custom_ppm = 0;
   int enable_biastee = 0;
-  int circbuffersize;
+  int enable_simd = 1;
+  int play;
+  int64_t circbuffersize;
+  int history_minutes = 0;
+  char *spill_name = NULL;
   int reprintline;
   int recording;
+  char *iq_filename = NULL;
+  char *channel_list = NULL;
+  int pfb = 0;
+  int workers = 0;
+  uint32_t n;
+  char channel_base[48];
+  char *tok;
+  struct channel_state *c;
+  int i;
   int charposition;
   int controldisabled;
   float newfrequency;
   struct tm *timeinfo;
   time_t rawtime;
+  struct ts_tag tag;
+  uint32_t slot;
+  int64_t from_ms, to_ms;
+  char typed[9];
   char infostr[255];
   char fileUniqueStr[255];
   char *filenameExt;
@@ -1361,8 +2562,6 @@ int main(int argc, char **argv)
 
   /* timeshift buffer size in kbytes */
   circbuffersize = 184320;
-  _circbufferslots = (circbuffersize * 1024) / CIRCBUFFCLUSTER;
-  _circbuffeshift=0;
 
 #ifdef _WIN32
   SetPriorityClass(GetCurrentProcess(), ABOVE_NORMAL_PRIORITY_CLASS);
@@ -1372,21 +2571,16 @@ int main(int argc, char **argv)
 
   printf("RTL FM Player Version %s (c) RafaelBF 2025.\n", VERSION);
 
-  if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-    fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
-    fprintf(stderr,"Press any key to exit\n");
-    _getch();
-    exit(1);
-  }
-
   dongle_init(&dongle);
   demod_init(&demod);
   output_init(&output);
   controller_init(&controller);
+  iqrec_init(&iqrec);
+  export_init(&wavexp);
 
   _isStartStream = false;
 
-  while((opt = getopt(argc, argv, "d:f:g:s:b:l:o:t:r:p:E:F:h:v:XYTV")) != -1)
+  while((opt = getopt(argc, argv, "d:f:g:s:b:l:o:t:r:p:A:C:E:F:I:L:M:P:S:W:h:v:XYTV")) != -1)
   {
     switch (opt)
     {
@@ -1455,32 +2649,109 @@ int main(int argc, char **argv)
       {
         demod.offset_tuning = 1;
       }
+      if (strcmp("zerocopy", optarg) == 0)
+      {
+        dongle.zerocopy = 1;
+      }
+      if (strcmp("nosimd", optarg) == 0)
+      {
+        enable_simd = 0;
+      }
+      if (strcmp("multipass", optarg) == 0)
+      {
+        demod.multipass = 1;
+      }
+      if (strcmp("pace", optarg) == 0)
+      {
+        dongle.pace = 1;
+      }
+      if (strcmp("pfb", optarg) == 0)
+      {
+        pfb = 1;
+      }
+      if (strcmp("lowlat", optarg) == 0)
+      {
+        _low_latency = 1;
+      }
+      if (strcmp("pull", optarg) == 0)
+      {
+        _audio_pull = 1;
+      }
+      if (strcmp("compress", optarg) == 0)
+      {
+        _ts_compress = 1;
+      }
+      break;
+    case 'I':
+      dongle.in_name = optarg;
+      break;
+    case 'W':
+      iq_filename = optarg;
+      break;
+    case 'M':
+      history_minutes = atoi(optarg);
+      if (history_minutes < 1)
+      {
+        fprintf(stderr, "Timeshift must be at least 1 minute\n");
+        history_minutes = 0;
+      }
+      break;
+    case 'S':
+      spill_name = optarg;
+      break;
+    case 'C':
+      channel_list = optarg;
       break;
     case 'F':
       demod.downsample_passes = 1;  /* truthy placeholder */
       demod.comp_fir_size = atoi(optarg);
       break;
+    case 'A':
+      if (strcmp("std", optarg) == 0)
+      {
+        demod.custom_atan = ATAN_STD;
+      }
+      if (strcmp("fast", optarg) == 0)
+      {
+        demod.custom_atan = ATAN_FAST;
+      }
+      if (strcmp("lut", optarg) == 0)
+      {
+        demod.custom_atan = ATAN_LUT;
+      }
+      break;
+    case 'L':
+      demod.lp_taps = atoi(optarg);
+      if (demod.lp_taps < 16 || demod.lp_taps > 512)
+      {
+        fprintf(stderr, "Lowpass taps must be between 16 and 512\n");
+        demod.lp_taps = 32;
+      }
+      break;
+    case 'P':
+      workers = atoi(optarg);
+      if (workers < 0 || workers > POOL_MAX_WORKERS)
+      {
+        fprintf(stderr, "Threads must be between 0 and %d\n", POOL_MAX_WORKERS);
+        workers = 0;
+      }
+      break;
 
     case 'X':
       fprintf(stderr, "Start with float FM stereo support\n");
       controller.wb_mode = 1;
       demod.rate_in = 192000;
       demod.rate_out = 192000;
-      output.rate = 48000;
-      demod.rate_out2 = 48000;
       demod.deemph = DEEMPHASIS_FM_EU;
       demod.squelch_level = 0;
       demod.lpr.mode = 2;
-      /* RPI can do only 90, 128 is optimal */
-      demod.lpr.size = 90;
+      demod.lpr.size = 128;
       break;
     case 'Y':
       fprintf(stderr, "Start with float FM mono support\n");
       controller.wb_mode = 1;
       demod.rate_in = 192000;
       demod.rate_out = 192000;
-      output.rate = 48000;
-      demod.rate_out2 = 48000;
       demod.deemph = DEEMPHASIS_FM_EU;
       demod.squelch_level = 0;
       demod.lpr.mode = 1;
@@ -1506,6 +2777,13 @@ int main(int argc, char **argv)
       break;
     }
   }
+  /* the filter bank puts its channels on the 100 kHz FM grid */
+  if (channel_list && pfb) {
+    _pfb.active = 1;
+    demod.rate_in = PFB_CHANNEL_RATE;
+    demod.rate_out = PFB_CHANNEL_RATE;
+  }
+
   /* quadruple sample_rate to limit to Δθ to ±π/2 */
   demod.rate_in *= demod.post_downsample;
 
@@ -1530,35 +2808,90 @@ int main(int argc, char **argv)
 
   ACTUAL_BUF_LENGTH = lcm_post[demod.post_downsample] * DEFAULT_BUF_LENGTH;
 
-  if (!dev_given) {
-    dongle.dev_index = verbose_device_search("0");
+  /* the blocks are what the audio waits for, not the DSP */
+  if (_low_latency) {
+    _read_block = LOWLAT_READ;
+    _channel_block = PFB_READ / (MAXIMUM_BUF_LENGTH / LOWLAT_READ);
+    audioFormatDesired.samples = LOWLAT_SDL_SAMPLES;
   }
 
-  if (dongle.dev_index < 0) {
+  /* unpaced offline input runs as fast as it can, nothing to play */
+  play = !dongle.in_name || dongle.pace;
+  _audio_muted = !play;
+
+  if (play && SDL_Init(SDL_INIT_AUDIO) < 0) {
+    fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
     fprintf(stderr,"Press any key to exit\n");
     _getch();
     exit(1);
   }
 
-  /* allocate timeshift buffer */
-  if (_beverbose)
-    fprintf(stderr, "Allocating %u bytes\n", _circbufferslots * CIRCBUFFCLUSTER);
-  _circbuffer = (char *)malloc(_circbufferslots * CIRCBUFFCLUSTER);
-  if (_circbuffer==0) {
+  if (dongle.in_name) {
+    dongle.source = &input_file;
+    /* held transfer buffers only exist with a dongle */
+    dongle.zerocopy = 0;
+  } else {
+    if (!dev_given) {
+      dongle.dev_index = verbose_device_search("0");
+    }
+
+    if (dongle.dev_index < 0) {
+      fprintf(stderr,"Press any key to exit\n");
+      _getch();
+      exit(1);
+    }
+  }
+
+  /* allocate timeshift buffer, -M is in minutes of raw S16 */
+  if (spill_name && !history_minutes)
+    history_minutes = TIMESHIFT_SPILL_MINUTES;
+  if (history_minutes)
+    circbuffersize = (int64_t) history_minutes * 60 * output.rate * (demod.lpr.mode == 2 ? 4 : 2) / 1024;
+  if (spill_name && _ts_compress)
+    fprintf(stderr, "The timeshift file is not compressed\n");
+  output.play = play;
+  if (output_alloc(&output, circbuffersize, spill_name) < 0) {
     fprintf(stderr,"Can't allocate memmory for timeshift function\n");
     fprintf(stderr,"Press any key to exit\n");
     _getch();
     exit(1);  
   }
+  if (_beverbose)
+  {
+    fprintf(stderr, "Allocating %d timeshift slots of %u bytes", output.ts.slots, output.cluster);
+    if (spill_name)
+      fprintf(stderr, ", %d in RAM and the rest in %s", output.ts.hot_slots, spill_name);
+    else if (output.ts.frame)
+      fprintf(stderr, ", %d raw and the rest packed into %llu bytes", output.ts.hot_slots,
+              (unsigned long long) output.ts.packed_size);
+    fprintf(stderr, "\n");
+  }
 
 
-  librtlerr = rtlsdr_open(&dongle.dev, (uint32_t) dongle.dev_index);
-  if (librtlerr < 0) {
-    free(_circbuffer);
-    fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dongle.dev_index);
-    fprintf(stderr,"Press any key to exit\n");
-    _getch();
-    exit(1);
+  if (dongle.in_name) {
+    librtlerr = 0;
+    if (strcmp(dongle.in_name, "-") == 0) {
+      dongle.in_file = stdin;
+#ifdef _WIN32
+      _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    } else {
+      dongle.in_file = fopen(dongle.in_name, "rb");
+    }
+    if (!dongle.in_file) {
+      output_cleanup(&output);
+      fprintf(stderr, "Failed to open %s: %s\n", dongle.in_name, strerror(errno));
+      exit(1);
+    }
+  } else {
+    librtlerr = rtlsdr_open(&dongle.dev, (uint32_t) dongle.dev_index);
+    if (librtlerr < 0) {
+      output_cleanup(&output);
+      fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dongle.dev_index);
+      fprintf(stderr,"Press any key to exit\n");
+      _getch();
+      exit(1);
+    }
   }
 #ifndef _WIN32
   sigact.sa_handler = sighandler;
@@ -1577,45 +2910,200 @@ int main(int argc, char **argv)
     demod.deemph_lambda = (float) exp(-1.0 / ((double) output.rate * demod.deemph));
   }
 
-  /* Set the tuner gain */
-  if (dongle.gain == AUTO_GAIN) {
-    if (_beverbose) {
-      verbose_auto_gain(dongle.dev);
+  if (dongle.dev) {
+    /* Set the tuner gain */
+    if (dongle.gain == AUTO_GAIN) {
+      if (_beverbose) {
+        verbose_auto_gain(dongle.dev);
+      } else {
+        if ( rtlsdr_set_tuner_gain_mode(dongle.dev, 0) != 0 )
+          fprintf(stderr, "WARNING: Failed to set tuner gain.\n");
+      }
     } else {
-      if ( rtlsdr_set_tuner_gain_mode(dongle.dev, 0) != 0 )
-        fprintf(stderr, "WARNING: Failed to set tuner gain.\n");
+      dongle.gain = nearest_gain(dongle.dev, dongle.gain);
+      verbose_gain_set(dongle.dev, dongle.gain);
     }
-  } else {
-    dongle.gain = nearest_gain(dongle.dev, dongle.gain);
-    verbose_gain_set(dongle.dev, dongle.gain);
+
+    rtlsdr_set_bias_tee(dongle.dev, enable_biastee);
+    if (enable_biastee)
+      if (_beverbose)
+        fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
+
+    verbose_ppm_set(dongle.dev, dongle.ppm_error);
   }
 
-  rtlsdr_set_bias_tee(dongle.dev, enable_biastee);
-  if (enable_biastee)
-    if (_beverbose)
-      fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
+  /* the other stations of -C, with the settings of the main one */
+  if (channel_list) {
+    if (controller.freq_len > 1) {
+      fprintf(stderr, "Channels can't be combined with scanning.\n");
+      exit(1);
+    }
+    demod.mixing = 1;
+    /* held transfer buffers can't be shared between the channels */
+    dongle.zerocopy = 0;
+    for (tok = strtok(channel_list, ","); tok; tok = strtok(NULL, ",")) {
+      if (_channel_count >= CHANNELS_LIMIT - 1) {
+        fprintf(stderr, "Too many channels, maximum %i.\n", CHANNELS_LIMIT);
+        break;
+      }
+      c = channel_new((uint32_t) atofs(tok));
+      if (!c) {
+        fprintf(stderr, "Can't allocate memory for the channel %s\n", tok);
+        exit(1);
+      }
+      _channels[_channel_count++] = c;
+    }
+    if (channel_settings() < 0) {
+      fprintf(stderr, "The channels don't fit in a capture of %u S/s.\n", CHANNEL_MAX_RATE);
+      exit(1);
+    }
+    /* the decimator has to separate stations 200 kHz apart */
+    if (demod.lp_taps < 16 * demod.downsample)
+      demod.lp_taps = 16 * demod.downsample;
+  }
 
-  verbose_ppm_set(dongle.dev, dongle.ppm_error);
+  /* 2x oversampled bank, every channel comes out at the demodulator rate */
+  if (_pfb.active) {
+    if (init_pfb_f32(&_pfb.bank, 2 * demod.downsample, demod.downsample, PFB_TAPS, MAXIMUM_BUF_LENGTH) < 0) {
+      fprintf(stderr, "Failed to allocate the filter bank\n");
+      exit(1);
+    }
+    if (pfb_add(&demod, controller.freqs[controller.freq_len-1], &_pfb.ring) < 0) {
+      fprintf(stderr, "Failed to allocate the filter bank\n");
+      exit(1);
+    }
+    for (i = 0; i < _channel_count; i++) {
+      if (pfb_add(&_channels[i]->demod, _channels[i]->freq, &_channels[i]->ring) < 0) {
+        fprintf(stderr, "Failed to allocate the filter bank\n");
+        exit(1);
+      }
+    }
+    if (_beverbose)
+      fprintf(stderr, "Filter bank of %d channels, %d taps\n", _pfb.bank.nch, _pfb.bank.nch * PFB_TAPS);
+  }
 
   /* Init FM float demodulator */
   init_u8_f32_table();
-  init_lp_f32();
-  init_lp_real_f32(&demod);
+  init_atan_lut();
+  if (_beverbose)
+    fprintf(stderr, "Using %s DSP kernels\n", init_simd(enable_simd));
+  else
+    init_simd(enable_simd);
+  /* settle downsample before the filter gets designed for it */
+  optimal_settings(controller.freqs[controller.freq_len-1], demod.rate_in);
+  if (!demod.channelized && init_decimator_f32(&demod.decim, demod.downsample, demod.lp_taps, MAXIMUM_BUF_LENGTH) < 0)
+  {
+    fprintf(stderr, "Failed to allocate the downsample filter\n");
+    exit(1);
+  }
+  if (init_demod_arena(&demod, demod.channelized ? PFB_READ : MAXIMUM_BUF_LENGTH,
+                       !dongle.zerocopy && !demod.channelized) < 0)
+  {
+    fprintf(stderr, "Failed to allocate the demodulator buffers\n");
+    exit(1);
+  }
+  if (_beverbose)
+    fprintf(stderr, "Init FIR hamming, size: %d sample_rate: %d\n", demod.lpr.size, demod.rate_in);
+  if (init_lp_real_f32(&demod) < 0)
+  {
+    fprintf(stderr, "Unsupported resample ratio %d -> %d\n", demod.rate_out, demod.rate_out2);
+    exit(1);
+  }
+  if (_channel_count && !_pfb.active)
+    init_mixer_f32(&demod.mix, (int) controller.freqs[controller.freq_len-1] - (int) dongle.freq, dongle.rate);
+  for (i = 0; i < _channel_count; i++)
+  {
+    c = _channels[i];
+    c->demod.downsample = demod.downsample;
+    c->demod.lp_taps = demod.lp_taps;
+    if (!_pfb.active)
+      init_mixer_f32(&c->demod.mix, (int) c->freq - (int) dongle.freq, dongle.rate);
+    if ((!c->demod.channelized && init_decimator_f32(&c->demod.decim, demod.downsample, demod.lp_taps, MAXIMUM_BUF_LENGTH) < 0) ||
+        init_demod_arena(&c->demod, c->demod.channelized ? PFB_READ : MAXIMUM_BUF_LENGTH, !c->demod.channelized) < 0 ||
+        init_lp_real_f32(&c->demod) < 0)
+    {
+      fprintf(stderr, "Failed to set up the channel at %u Hz\n", c->freq);
+      exit(1);
+    }
+    if (_beverbose)
+      fprintf(stderr, "Channel %u Hz, %+d Hz from the center\n", c->freq, (int) c->freq - (int) dongle.freq);
+  }
+  /* a job per worker and one more to fill while they are all busy,
+   multipass stays the single threaded reference */
+  if (workers > 0 && !demod.multipass) {
+    if (init_demod_jobs(&demod, workers + 1) < 0) {
+      fprintf(stderr, "Failed to allocate the demodulator jobs\n");
+      exit(1);
+    }
+    for (i = 0; i < _channel_count; i++) {
+      if (init_demod_jobs(&_channels[i]->demod, workers + 1) < 0) {
+        fprintf(stderr, "Failed to allocate the demodulator jobs\n");
+        exit(1);
+      }
+    }
+    if (pool_start(workers) < 0) {
+      fprintf(stderr, "Failed to start the demodulator threads\n");
+      exit(1);
+    }
+    if (_beverbose)
+      fprintf(stderr, "Demodulating on %d threads\n", workers);
+  }
+  /* dongle IQ for the demodulator or the mixer, channel IQ out of the bank */
+  n = input_ring_size(dongle.rate * 2, MAXIMUM_BUF_LENGTH);
+  _input_buffer = malloc(n);
+  if (!_input_buffer) {
+    fprintf(stderr, "Failed to allocate the input buffer\n");
+    exit(1);
+  }
+  ring_init(&_input_ring, _input_buffer, n);
+  if (_beverbose)
+    fprintf(stderr, "Input ring %u KB\n", n / 1024);
+  if (_pfb.active) {
+    n = input_ring_size(demod.rate_in * 2 * sizeof(float), PFB_READ);
+    _pfb.ring_buf = malloc(n);
+    if (!_pfb.ring_buf) {
+      fprintf(stderr, "Failed to allocate the input buffer\n");
+      exit(1);
+    }
+    ring_init(&_pfb.ring, _pfb.ring_buf, n);
+  }
+  for (i = 0; i < _channel_count; i++) {
+    c = _channels[i];
+    c->ring_buf = malloc(n);
+    if (!c->ring_buf) {
+      fprintf(stderr, "Failed to allocate the input buffer\n");
+      exit(1);
+    }
+    ring_init(&c->ring, c->ring_buf, n);
+  }
+  ring_init(&_block_ring, _block_ring_buffer, sizeof(_block_ring_buffer));
+
+  if (iq_filename && iqrec_start(&iqrec, iq_filename, &dongle) < 0)
+    fprintf(stderr, "Error saving IQ to %s. %s\n", iq_filename, strerror(errno));
 
 
   /* Reset endpoint before we start reading from it (mandatory) */
-  verbose_reset_buffer(dongle.dev);
+  if (dongle.dev)
+    verbose_reset_buffer(dongle.dev);
 
   /* start threads */
   pthread_create(&controller.thread, NULL, controller_thread_fn, (void *) (&controller));
   usleep(500000);
 
+  output.freq = controller.freqs[controller.freq_now];
   pthread_create(&output.thread, NULL, output_thread_fn, (void *) (&output));
 
   pthread_create(&demod.thread, NULL, demod_thread_fn, (void *) (&demod));
 
-  /* Start reading samples from dongle  */
-  pthread_create(&dongle.thread, NULL, dongle_thread_fn, (void *) (&dongle));
+  for (i = 0; i < _channel_count; i++) {
+    pthread_create(&_channels[i]->output.thread, NULL, output_thread_fn, (void *) (&_channels[i]->output));
+    pthread_create(&_channels[i]->demod.thread, NULL, demod_thread_fn, (void *) (&_channels[i]->demod));
+  }
+  if (_pfb.active)
+    pthread_create(&_pfb.thread, NULL, pfb_thread_fn, (void *) (&_pfb));
+
+  /* Start reading samples from dongle or file */
+  pthread_create(&dongle.thread, NULL, dongle.source->thread_fn, (void *) (&dongle));
 
   optimal_settings(controller.freqs[controller.freq_len-1], demod.rate_in);
 
@@ -1628,13 +3116,20 @@ int main(int argc, char **argv)
     audioFormatDesired.channels = 1;
   }
 
-  _audio_device = SDL_OpenAudioDevice(NULL, 0, &audioFormatDesired, &audioFormatObtained, 0);
-  if (_audio_device==0) {
+  audioFormatDesired.freq = output.rate;
+  if (_audio_pull) {
+    audioFormatDesired.callback = output_audio_pull;
+    audioFormatDesired.userdata = &output;
+  }
+  if (!play) {
+    _audio_device = 0;
+  } else if ((_audio_device = SDL_OpenAudioDevice(NULL, 0, &audioFormatDesired, &audioFormatObtained, 0)) == 0) {
     fprintf(stderr,"Could not retrieve a valid audio device: %s.\n", SDL_GetError());
     fprintf(stderr,"Press any key to exit\n");
     _getch();
     _do_exit=1;  
   } else {
+    _audio_device_samples = audioFormatObtained.samples;
     if (_beverbose)    
       fprintf(stderr,"Opened audio, device %s, freq %d, size %d, format %d, channels %d, samples %d", SDL_GetCurrentAudioDriver(),
              audioFormatObtained.freq, audioFormatObtained.size, audioFormatObtained.format, audioFormatObtained.channels, audioFormatObtained.samples);
@@ -1644,7 +3139,7 @@ int main(int argc, char **argv)
   /* filename given at command line */
   controldisabled=0;
   if (output.filename!=0) {
-    output.file = InitWaveOut(output.filename,demod.lpr.mode);
+    output.file = InitWaveOut(output.filename,demod.lpr.mode,output.rate);
     if (output.file==NULL) {
       output.filename=0;
       fprintf(stderr, "Error saving to file. %s\r", strerror( errno) );
@@ -1653,46 +3148,96 @@ int main(int argc, char **argv)
     }
   }
 
+  /* every other channel is recorded to <filename>_<kHz>.wav */
+  if (output.filename!=0 && strcmp(output.filename, "-") != 0) {
+    snprintf(channel_base, sizeof(channel_base), "%s", output.filename);
+    filenameExt = strrchr(channel_base, '.');
+    if (filenameExt)
+      *filenameExt = 0;
+  } else {
+    strcpy(channel_base, "FMchannel");
+  }
+  for (i = 0; i < _channel_count; i++) {
+    c = _channels[i];
+    snprintf(c->filename, sizeof(c->filename), "%s_%u.wav", channel_base, c->freq / 1000);
+    c->output.file = InitWaveOut(c->filename, demod.lpr.mode, output.rate);
+    if (c->output.file==NULL)
+      fprintf(stderr, "Error saving to %s. %s\n", c->filename, strerror( errno) );
+    else
+      c->output.filename = c->filename;
+  }
+
   SDL_PauseAudioDevice(_audio_device, 0);
   _isStartStream = true;
 
   //////////////////// MAIN LOOP //////////////////////
 
   reprintline=1;
-  _audio_muted=0;
   recording=0;
 
-  printf("\n+----------------------------------------------------------------------------+\n");
-  printf("|                               RTL FM Player                                |\n");
-  printf("+--------------------------------  k e y s ----------------------------------+\n");
-
-  if (!controldisabled) {
-    printf("| [W]: +50KHz [S]: -50KHz  [T]: Type a frequency                             |\n");
-    printf("| [A]: TimeShift [Past]  [D]: TimeShift [Present]  [L]: TimeShift [Live]     |\n");
-    printf("| [M]: Mute/Unmute                                                           |\n");
-    printf("| [R]: Record/Stop                                                           |\n");
-    printf("| [X]: Exit                                                                  |\n");
-    printf("+----------------------------------------------------------------------------+\n\n");
+  if (_channel_count) {
+    printf("\nCapturing %u S/s at %.3f MHz\n", dongle.rate, dongle.freq / 1e6);
+    for (i = 0; i < _channel_count; i++) {
+      if (_channels[i]->output.filename!=0)
+        printf("Recording %.2f MHz to %s\n", _channels[i]->freq / 1e6, _channels[i]->output.filename);
+    }
+  }
 
+  /* offline input ends by itself, there is nothing to tune */
+  if (dongle.in_file) {
+    printf("\nReading %s (%s)%s\n", dongle.in_name, dongle.source->name, dongle.pace ? " in real time" : "");
+    if (output.filename!=0)
+      printf("Saving audio to %s\n", output.filename);
+    while (!_do_exit && !outputs_drained())
+      usleep(100000);
+    _do_exit = 1;
   } else {
-    printf("| [X]: Exit                                                                  |\n");
-    printf("+----------------------------------------------------------------------------+\n\n");
-    
-    
-    printf("  >>> %.2f MHz <<<\n", ((float)((int)(controller.freqs[controller.freq_len-1] / 10000)) / 100.0));
-    printf("Controls disabled. Saving audio to %s\n\n",output.filename);
-    reprintline=0;
+    printf("\n+----------------------------------------------------------------------------+\n");
+    printf("|                               RTL FM Player                                |\n");
+    printf("+--------------------------------  k e y s ----------------------------------+\n");
+
+    if (!controldisabled) {
+      if (_channel_count)
+        printf("| Tuning is fixed by the channels                                            |\n");
+      else
+        printf("| [W]: +50KHz [S]: -50KHz  [T]: Type a frequency                             |\n");
+      printf("| [A]: TimeShift [Past]  [D]: TimeShift [Present]  [L]: TimeShift [Live]     |\n");
+      printf("| [J]: Jump to a time  [B]: Back to the start of the station  [E]: Export    |\n");
+      printf("| [M]: Mute/Unmute                                                           |\n");
+      printf("| [R]: Record/Stop  [I]: IQ Record/Stop                                      |\n");
+      printf("| [X]: Exit                                                                  |\n");
+      printf("+----------------------------------------------------------------------------+\n\n");
+
+    } else {
+      printf("| [X]: Exit                                                                  |\n");
+      printf("+----------------------------------------------------------------------------+\n\n");
+      
+      
+      printf("  >>> %.2f MHz <<<\n", ((float)((int)(controller.freqs[controller.freq_len-1] / 10000)) / 100.0));
+      printf("Controls disabled. Saving audio to %s\n\n",output.filename);
+      reprintline=0;
+    }
   }
 
 
   while (!_do_exit)
   {
 
-    /* [TimeShift100%] [Mute] [Rec] */
-    if (_circbuffeshift <= 0) {
+    /* [TimeShift 14:32:05] [Mute] [Rec], with the frequency if it was another one */
+    if (output.circbuffershift <= 0) {
       strcpy(infostr,"[Live] ");
+    } else if (output_playing(&output, &slot, &tag) == 0) {
+      rawtime = (time_t) (tag.ms / 1000);
+      timeinfo = localtime ( &rawtime );
+      strftime(infostr, sizeof(infostr), "[TimeShift %H:%M:%S", timeinfo);
+      if (tag.freq != output.freq)
+        sprintf(infostr + strlen(infostr), " %.2f MHz", tag.freq / 1e6);
+      strcat(infostr, "] ");
     } else {
-      sprintf(infostr,"[TimeShift%u%%] ",((_circbuffeshift *100) / _circbufferslots));
+      strcpy(infostr,"[TimeShift] ");
+    }
+    if (demod.lpr.mode == 2) {
+      strcat(infostr, (demod.lpr.pd.present && demod.lpr.pll.locked) ? "[Stereo] " : "[Mono]   ");
     }
     if (_audio_muted) {
       strcat(infostr, "[Mute]  ");
@@ -1707,6 +3252,12 @@ int main(int argc, char **argv)
         strcat(infostr, "                     ");    
     }          /* [Live]
                   [TimeShift100%] [Mute] [Rec] */
+    if (iqrec.active)
+      strcat(infostr, "[IQ] ");
+    if (wavexp.active)
+      sprintf(infostr + strlen(infostr), "[Export %d%%] ", wavexp.percent);
+    if ((_low_latency || _audio_pull) && !_audio_muted)
+      sprintf(infostr + strlen(infostr), "[%u ms] ", output.latency_ms);
 
 
     if (reprintline) {
@@ -1722,33 +3273,33 @@ int main(int argc, char **argv)
 
     if (!controldisabled) {
 
-      if ((keybrd==119) || (keybrd==87)) { /* W */
+      if (!_channel_count && ((keybrd==119) || (keybrd==87))) { /* W */
         controller.freqs[controller.freq_len-1] += 50000;
         sanity_checks();
         optimal_settings(controller.freqs[controller.freq_len-1], demod.rate_in);
         if ( rtlsdr_set_center_freq(dongle.dev, dongle.freq) < 0 ) {
           fprintf(stderr, "WARNING: Failed to set center freq.\r");
         } else {
-          _circbuffeshift=0;
+          output.circbuffershift=0;
+          output.freq=controller.freqs[controller.freq_len-1];
           reprintline=1;
-          if (SDL_GetQueuedAudioSize(_audio_device) > CIRCBUFFCLUSTER * 5)
-            SDL_ClearQueuedAudio(_audio_device);
+          audio_seeked();
         }
       }
-      if ((keybrd==115) || (keybrd==83)) { /* S */
+      if (!_channel_count && ((keybrd==115) || (keybrd==83))) { /* S */
         controller.freqs[controller.freq_len-1] -= 50000;
         sanity_checks();
         optimal_settings(controller.freqs[controller.freq_len-1], demod.rate_in);
         if ( rtlsdr_set_center_freq(dongle.dev, dongle.freq) < 0 ) {
           fprintf(stderr, "WARNING: Failed to set center freq.\r");
         } else {
-          _circbuffeshift=0;
+          output.circbuffershift=0;
+          output.freq=controller.freqs[controller.freq_len-1];
           reprintline=1;
-          if (SDL_GetQueuedAudioSize(_audio_device) > CIRCBUFFCLUSTER * 5)
-            SDL_ClearQueuedAudio(_audio_device);
+          audio_seeked();
         }
       }
-      if ((keybrd==116) || (keybrd==84)) { /* T */
+      if (!_channel_count && ((keybrd==116) || (keybrd==84))) { /* T */
         printf("                                                  \r"); /* clear this line */
         printf("Type the new frequency: ");
         newfrequency=0;      
@@ -1776,28 +3327,47 @@ int main(int argc, char **argv)
           if ( rtlsdr_set_center_freq(dongle.dev, dongle.freq) < 0 ) {
             fprintf(stderr, "WARNING: Failed to set center freq.\r");
           } else {
-            _circbuffeshift=0;
+            output.circbuffershift=0;
+            output.freq=controller.freqs[controller.freq_len-1];
             reprintline=1;
-            if (SDL_GetQueuedAudioSize(_audio_device) > CIRCBUFFCLUSTER * 5)
-              SDL_ClearQueuedAudio(_audio_device);
+            audio_seeked();
           }
         
       } /* if keybrd */
 
       if ((keybrd==97) || (keybrd==65)) { /* A */
-        _circbuffeshift+=20;
+        output_seek(&output, -SEEK_STEP_MS);
         reprintline=1;
-        if (SDL_GetQueuedAudioSize(_audio_device) > CIRCBUFFCLUSTER * 5)
-          SDL_ClearQueuedAudio(_audio_device);
       }
       if ((keybrd==100) || (keybrd==68)) { /* D */
-        _circbuffeshift-=20;
+        output_seek(&output, SEEK_STEP_MS);
+        reprintline=1;
+      }
+      if ((keybrd==106) || (keybrd==74)) { /* J */
+        if (read_clock("Jump to the time (hh:mm:ss): ", typed, &from_ms) == 0 &&
+            output_seek_to(&output, from_ms) < 0)
+          fprintf(stderr, "%s is not in the timeshift buffer\r", typed);
+        reprintline=1;
+      }
+      if ((keybrd==98) || (keybrd==66)) { /* B */
+        output_seek_station(&output);
+        reprintline=1;
+      }
+      if ((keybrd==101) || (keybrd==69)) { /* E */
+        /* from a time of day or minutes back, up to a time or now */
+        to_ms = (int64_t) (time_now() * 1000.0);
+        if (read_clock("Export from (hh:mm:ss, or minutes back): ", typed, &from_ms) < 0)
+          from_ms = to_ms - (int64_t) (typed[0] ? atoi(typed) : EXPORT_MINUTES) * 60000;
+        else
+          read_clock("Export up to (hh:mm:ss, Enter for now): ", typed, &to_ms);
+        if (export_start(&wavexp, &output, from_ms, to_ms) < 0)
+          fprintf(stderr, "Nothing of that could be exported from the timeshift buffer\r");
+        else
+          printf("Exporting to %s\n", wavexp.filename);
         reprintline=1;
-        if (SDL_GetQueuedAudioSize(_audio_device) > CIRCBUFFCLUSTER * 5)
-          SDL_ClearQueuedAudio(_audio_device);
       }
       if ((keybrd==108) || (keybrd==76)) { /* P */
-        _circbuffeshift=0;
+        output.circbuffershift=0;
         reprintline=1;
       }
       if ((keybrd==109) || (keybrd==77)) { /* M */
@@ -1805,8 +3375,7 @@ int main(int argc, char **argv)
           SDL_PauseAudioDevice(_audio_device, 1);
           _audio_muted=1;
         } else {
-          if (SDL_GetQueuedAudioSize(_audio_device) > CIRCBUFFCLUSTER * 5)
-            SDL_ClearQueuedAudio(_audio_device);
+          audio_seeked();
           SDL_PauseAudioDevice(_audio_device, 0);
           _audio_muted=0;
         }
@@ -1819,7 +3388,7 @@ int main(int argc, char **argv)
           timeinfo = localtime ( &rawtime );
           
           strftime(fileUniqueStr, 34,"FMrecord_%Y-%m-%d_%H-%M-%S.wav",timeinfo);
-          output.file = InitWaveOut(fileUniqueStr,demod.lpr.mode);
+          output.file = InitWaveOut(fileUniqueStr,demod.lpr.mode,output.rate);
           
           if (output.file==NULL) {
             fprintf(stderr, "Error saving to file. %s\r", strerror( errno) );
@@ -1836,6 +3405,20 @@ int main(int argc, char **argv)
         }
       }
       
+      if ((keybrd==105) || (keybrd==73)) { /* I */
+        if (!iqrec.active) {
+          time ( &rawtime );
+          timeinfo = localtime ( &rawtime );
+
+          strftime(fileUniqueStr, 34,"IQrecord_%Y-%m-%d_%H-%M-%S.iq",timeinfo);
+          if (iqrec_start(&iqrec, fileUniqueStr, &dongle) < 0)
+            fprintf(stderr, "Error saving IQ to file. %s\r", strerror( errno) );
+        } else {
+          iqrec_stop(&iqrec);
+        }
+        reprintline=1;
+      }
+
     } /* controldisabled */
 
     if ((keybrd==120) || (keybrd==88)) { /* X */
@@ -1848,7 +3431,9 @@ int main(int argc, char **argv)
 
 
 
-  if (_do_exit) {
+  if (ATOMIC_LOAD_ACQ(&dongle.eof)) {
+    fprintf(stderr, "\nEnd of input, exiting...\n");
+  } else if (_do_exit) {
     fprintf(stderr, "\nUser cancel, exiting...\n");
     } else {
     fprintf(stderr, "\nLibrary error, exiting...\n" );
@@ -1867,10 +3452,24 @@ int main(int argc, char **argv)
   /* wait for dongle thread
      rtlsdr_cancel_async must be called inside rtlsdr_callback thread */
   pthread_join(dongle.thread, NULL); 
+  if (_pfb.active)
+    pthread_join(_pfb.thread, NULL);
+  /* the output threads and offline demodulators sleep on their buffers */
+  output_wake(&output);
+  for (i = 0; i < _channel_count; i++)
+    output_wake(&_channels[i]->output);
   safe_cond_signal(&demod.ready, &demod.ready_m);
   pthread_join(demod.thread, NULL);
-  safe_cond_signal(&output.ready, &output.ready_m);
   pthread_join(output.thread, NULL);
+  for (i = 0; i < _channel_count; i++) {
+    pthread_join(_channels[i]->demod.thread, NULL);
+    pthread_join(_channels[i]->output.thread, NULL);
+    if (_channels[i]->output.filename!=0)
+      CloseWaveOut(_channels[i]->output.file);
+    channel_free(_channels[i]);
+  }
+  if (_pool.workers)
+    pool_stop();
   safe_cond_signal(&controller.hop, &controller.hop_m);
   pthread_join(controller.thread, NULL);
 
@@ -1879,16 +3478,30 @@ int main(int argc, char **argv)
   demod_cleanup(&demod);
   if (_beverbose)
     fprintf(stderr, "Closing output\n");
+  export_stop(&wavexp);
   output_cleanup(&output);
   if (_beverbose)
     fprintf(stderr, "Closing controller\n");
   controller_cleanup(&controller);
-
-  free(_circbuffer);
+  ring_cleanup(&_input_ring);
+  free(_input_buffer);
+  ring_cleanup(&_block_ring);
+  if (_pfb.active) {
+    for (i = 0; i < _pfb.nbins; i++)
+      free(_pfb.ob[i]);
+    deinit_pfb_f32(&_pfb.bank);
+    ring_cleanup(&_pfb.ring);
+    free(_pfb.ring_buf);
+  }
 
   if (_beverbose)
     fprintf(stderr, "Closing dongle\n");
-  rtlsdr_close(dongle.dev);
+  iqrec_stop(&iqrec);
+  iqrec_cleanup(&iqrec);
+  if (dongle.dev)
+    rtlsdr_close(dongle.dev);
+  if (dongle.in_file && dongle.in_file != stdin)
+    fclose(dongle.in_file);
 
   SDL_Quit();
 
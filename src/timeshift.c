@@ -0,0 +1,718 @@
+/*
+ * timeshift, the audio history of rtl_fm_player
+ * Based on rtl_fm_streamer by Albrecht Lohoefener
+ * Based on "rtl_fm", see http://sdr.osmocom.org/trac/wiki/rtl-sdr for details
+ *
+ * Copyright (C) 2012 by Steve Markgraf <steve@steve-m.de>
+ * Copyright (C) 2012 by Hoernchen <la@tfc-server.de>
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ * Copyright (C) 2013 by Elias Oenal <EliasOenal@gmail.com>
+ * Copyright (C) 2015 by Miroslav Slugen <thunder.m@email.cz>
+ * Copyright (C) 2015 by Albrecht Lohoefener <albrechtloh@gmx.de>
+ * Copyright (C) 2024 by Rafael Ferrari <rafaelbf@hotmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* sync_file_range */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#include "timeshift.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TS_LOAD_ACQ(p)			__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define TS_STORE_REL(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define TS_FENCE_ACQ()			__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define TS_FENCE_REL()			__atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define TS_LOAD_ACQ(p)			(MemoryBarrier(), *(p))
+#define TS_STORE_REL(p, v)		do { MemoryBarrier(); *(p) = (v); } while (0)
+#define TS_FENCE_ACQ()			MemoryBarrier()
+#define TS_FENCE_REL()			MemoryBarrier()
+#endif
+
+/* packed slots, FLAC style: stereo as mid and side, for each channel the
+ fixed predictor of order 0 to TS_ORDER that leaves the least, and the
+ residuals Rice coded in partitions of TS_PART samples with a parameter
+ each. A slot that doesn't get smaller is kept raw */
+#define TS_ORDER				4
+#define TS_PART					256
+#define TS_KMAX					20
+#define TS_WARM					17	/* bits of a zigzag warm-up sample, side needs 17 */
+#define TS_ESC					24	/* a longer unary part is sent as TS_RAW bits */
+#define TS_RAW					24
+
+struct ts_bits
+{
+  uint8_t *p;
+  uint32_t len;
+  uint32_t pos;
+  uint64_t acc;
+  int n;
+  int over; /* ran past len */
+};
+
+static void bits_put(struct ts_bits *b, uint32_t v, int n)
+{
+  b->acc = (b->acc << n) | (v & (uint32_t) ((1ull << n) - 1));
+  b->n += n;
+  while (b->n >= 8)
+  {
+    b->n -= 8;
+    if (b->pos < b->len)
+      b->p[b->pos++] = (uint8_t) (b->acc >> b->n);
+    else
+      b->over = 1;
+  }
+}
+
+static uint32_t bits_get(struct ts_bits *b, int n)
+{
+  while (b->n < n)
+  {
+    b->acc <<= 8;
+    if (b->pos < b->len)
+      b->acc |= b->p[b->pos++];
+    else
+      b->over = 1;
+    b->n += 8;
+  }
+  b->n -= n;
+  return (uint32_t) (b->acc >> b->n) & ((1u << n) - 1);
+}
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t) v << 1) ^ (uint32_t) -(v < 0);
+}
+
+static int32_t unzigzag(uint32_t u)
+{
+  return (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+}
+
+static int32_t ts_predict(const int32_t *x, int i, int order)
+{
+  switch (order)
+  {
+  case 1: return x[i-1];
+  case 2: return 2*x[i-1] - x[i-2];
+  case 3: return 3*x[i-1] - 3*x[i-2] + x[i-3];
+  case 4: return 4*x[i-1] - 6*x[i-2] + 4*x[i-3] - x[i-4];
+  }
+  return 0;
+}
+
+static void ts_pack_channel(struct ts_bits *b, const int32_t *x, int n)
+{
+  uint64_t sum[TS_ORDER + 1] = {0};
+  uint64_t part;
+  uint32_t u, q;
+  int order = 0;
+  int i, j, o, k, end;
+
+  for (i = TS_ORDER; i < n; i++)
+    for (o = 0; o <= TS_ORDER; o++)
+      sum[o] += zigzag(x[i] - ts_predict(x, i, o));
+  for (o = 1; o <= TS_ORDER && o <= n; o++)
+    if (sum[o] < sum[order])
+      order = o;
+
+  bits_put(b, (uint32_t) order, 3);
+  for (i = 0; i < order; i++)
+    bits_put(b, zigzag(x[i]), TS_WARM);
+  for (i = order; i < n; i = end)
+  {
+    end = i + TS_PART < n ? i + TS_PART : n;
+    part = 0;
+    for (j = i; j < end; j++)
+      part += zigzag(x[j] - ts_predict(x, j, order));
+    /* 2^k near the mean */
+    k = 0;
+    while (k < TS_KMAX && ((uint64_t) (end - i) << (k + 1)) <= part)
+      k++;
+    bits_put(b, (uint32_t) k, 5);
+    for (j = i; j < end; j++)
+    {
+      u = zigzag(x[j] - ts_predict(x, j, order));
+      q = u >> k;
+      if (q < TS_ESC)
+      {
+        bits_put(b, 1, (int) q + 1);
+        bits_put(b, u, k);
+      }
+      else
+      {
+        bits_put(b, 0, TS_ESC);
+        bits_put(b, u, TS_RAW);
+      }
+    }
+  }
+}
+
+static int ts_unpack_channel(struct ts_bits *b, int32_t *x, int n)
+{
+  uint32_t u, q;
+  int order, i, j, k, end;
+
+  order = (int) bits_get(b, 3);
+  if (order > TS_ORDER || order > n)
+    return -1;
+  for (i = 0; i < order; i++)
+    x[i] = unzigzag(bits_get(b, TS_WARM));
+  for (i = order; i < n; i = end)
+  {
+    end = i + TS_PART < n ? i + TS_PART : n;
+    k = (int) bits_get(b, 5);
+    if (k > TS_KMAX)
+      return -1;
+    for (j = i; j < end; j++)
+    {
+      q = 0;
+      while (q < TS_ESC && !bits_get(b, 1))
+        q++;
+      u = q < TS_ESC ? (q << k) | bits_get(b, k) : bits_get(b, TS_RAW);
+      x[j] = unzigzag(u) + ts_predict(x, j, order);
+    }
+    if (b->over)
+      return -1;
+  }
+  return 0;
+}
+
+/* into out, which has room for slot_size + 1. returns the length */
+static uint32_t ts_pack(struct timeshift *t, const char *in, uint8_t *out)
+{
+  const int16_t *pcm = (const int16_t *) in;
+  int32_t *x = t->work;
+  int n = (int) t->slot_size / t->frame;
+  int i;
+  struct ts_bits b = {out + 1, t->slot_size, 0, 0, 0, 0};
+
+  if (t->frame == 4)
+  {
+    for (i = 0; i < n; i++)
+    {
+      x[i] = (pcm[2*i] + pcm[2*i+1]) >> 1;
+      x[n+i] = pcm[2*i] - pcm[2*i+1];
+    }
+    ts_pack_channel(&b, x, n);
+    ts_pack_channel(&b, x + n, n);
+  }
+  else
+  {
+    for (i = 0; i < n; i++)
+      x[i] = pcm[i];
+    ts_pack_channel(&b, x, n);
+  }
+  if (b.n)
+    bits_put(&b, 0, 8 - b.n);
+  if (b.over || b.pos >= t->slot_size)
+  {
+    out[0] = 0;
+    memcpy(out + 1, in, t->slot_size);
+    return t->slot_size + 1;
+  }
+  out[0] = 1;
+  return b.pos + 1;
+}
+
+static int ts_unpack(struct timeshift *t, const uint8_t *in, uint32_t len, char *out, int32_t *x)
+{
+  int16_t *pcm = (int16_t *) out;
+  int n = (int) t->slot_size / t->frame;
+  int32_t mid, side;
+  int i;
+  struct ts_bits b = {(uint8_t *) in + 1, len - 1, 0, 0, 0, 0};
+
+  if (len < 1)
+    return -1;
+  if (in[0] == 0)
+  {
+    if (len != t->slot_size + 1)
+      return -1;
+    memcpy(out, in + 1, t->slot_size);
+    return 0;
+  }
+  if (ts_unpack_channel(&b, x, n) < 0)
+    return -1;
+  if (t->frame == 2)
+  {
+    for (i = 0; i < n; i++)
+      pcm[i] = (int16_t) x[i];
+    return 0;
+  }
+  if (ts_unpack_channel(&b, x + n, n) < 0)
+    return -1;
+  for (i = 0; i < n; i++)
+  {
+    side = x[n+i];
+    mid = x[i] * 2 + (side & 1);
+    pcm[2*i] = (int16_t) ((mid + side) >> 1);
+    pcm[2*i+1] = (int16_t) ((mid - side) >> 1);
+  }
+  return 0;
+}
+
+void ts_reader_init(struct ts_reader *r)
+{
+  r->map = NULL;
+  r->chunk = -1;
+  r->pcm = NULL;
+  r->copy = NULL;
+  r->work = NULL;
+  r->pcm_n = 0;
+  r->pcm_ok = 0;
+}
+
+static void ts_unmap(struct timeshift *t, struct ts_reader *r)
+{
+  if (!r->map)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(r->map);
+#else
+  munmap(r->map, TS_CHUNK);
+#ifdef __linux__
+  /* written chunks go to disk now and old ones leave the page cache,
+   so hours of history don't push everything else out of memory */
+  if (r == &t->w)
+    sync_file_range(t->fd, r->chunk * TS_CHUNK, TS_CHUNK, SYNC_FILE_RANGE_WRITE);
+  else if (r->chunk != t->w.chunk)
+    posix_fadvise(t->fd, r->chunk * TS_CHUNK, TS_CHUNK, POSIX_FADV_DONTNEED);
+#endif
+#endif
+  r->map = NULL;
+  r->chunk = -1;
+}
+
+void ts_reader_free(struct timeshift *t, struct ts_reader *r)
+{
+  ts_unmap(t, r);
+  free(r->pcm);
+  ts_reader_init(r);
+}
+
+/* chunks start on TS_CHUNK boundaries of the file, which keeps every
+ mapping aligned, the tail of a chunk after its last slot is unused */
+static char *ts_map(struct timeshift *t, struct ts_reader *r, int64_t chunk)
+{
+#ifdef _WIN32
+  uint64_t off = (uint64_t) chunk * TS_CHUNK;
+#endif
+
+  if (r->chunk == chunk)
+    return r->map;
+  ts_unmap(t, r);
+#ifdef _WIN32
+  r->map = MapViewOfFile((HANDLE) t->mapping, r == &t->w ? FILE_MAP_WRITE : FILE_MAP_READ,
+    (DWORD) (off >> 32), (DWORD) off, TS_CHUNK);
+  if (!r->map)
+    return NULL;
+#else
+  r->map = mmap(NULL, TS_CHUNK, r == &t->w ? PROT_READ | PROT_WRITE : PROT_READ,
+    MAP_SHARED, t->fd, (off_t) (chunk * TS_CHUNK));
+  if (r->map == MAP_FAILED)
+  {
+    r->map = NULL;
+    return NULL;
+  }
+  madvise(r->map, TS_CHUNK, MADV_SEQUENTIAL);
+#endif
+  r->chunk = chunk;
+  return r->map;
+}
+
+static char *ts_spilled(struct timeshift *t, struct ts_reader *r, uint32_t k)
+{
+  char *map = ts_map(t, r, k / t->chunk_slots);
+
+  if (!map)
+    return NULL;
+  return map + (size_t) (k % t->chunk_slots) * t->slot_size;
+}
+
+static int ts_spill_open(struct timeshift *t, const char *path)
+{
+  int64_t size = (int64_t) (t->slots / t->chunk_slots) * TS_CHUNK;
+#ifdef _WIN32
+  t->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+    FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+  if (t->file == INVALID_HANDLE_VALUE)
+  {
+    t->file = NULL;
+    return -1;
+  }
+  /* the mapping object sizes the file */
+  t->mapping = CreateFileMappingA((HANDLE) t->file, NULL, PAGE_READWRITE,
+    (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+  if (!t->mapping)
+    return -1;
+#else
+  t->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (t->fd < 0)
+    return -1;
+  /* scratch only, gone with the process */
+  unlink(path);
+  /* reserve the blocks now, a full disk shows at startup */
+#ifdef __linux__
+  if (posix_fallocate(t->fd, 0, (off_t) size) != 0 && ftruncate(t->fd, (off_t) size) < 0)
+    return -1;
+#else
+  if (ftruncate(t->fd, (off_t) size) < 0)
+    return -1;
+#endif
+#endif
+  return 0;
+}
+
+void ts_init(struct timeshift *t)
+{
+  t->slot_size = 0;
+  t->slots = 0;
+  t->hot_slots = 0;
+  t->written = 0;
+  t->tags = NULL;
+  t->hot = NULL;
+  t->fd = -1;
+  t->chunk_slots = 0;
+#ifdef _WIN32
+  t->file = NULL;
+  t->mapping = NULL;
+#endif
+  ts_reader_init(&t->w);
+  t->frame = 0;
+  t->packed = NULL;
+  t->packed_size = 0;
+  t->packed_end = 0;
+  t->pos = NULL;
+  t->len = NULL;
+  t->oldest = 0;
+  t->out = NULL;
+  t->work = NULL;
+}
+
+/* the byte ring holds the slots raw slots even if they don't compress,
+ with the byte each one grows by then and a slot lost at the wrap, so the
+ history is never shorter than uncompressed. TS_HOT comes on top */
+static int ts_pack_open(struct timeshift *t, int slots, int frame)
+{
+  uint64_t size = (uint64_t) slots * t->slot_size;
+
+  t->frame = frame;
+  t->hot_slots = TS_HOT / (int) t->slot_size;
+  if (t->hot_slots < 4)
+    t->hot_slots = 4;
+  if (t->hot_slots > slots)
+    t->hot_slots = slots;
+  t->slots = slots * TS_PACK_RATIO;
+  t->packed_size = size + (uint64_t) slots + t->slot_size + 1;
+  t->hot = malloc((size_t) t->hot_slots * t->slot_size);
+  t->packed = malloc((size_t) t->packed_size);
+  t->pos = malloc((size_t) t->slots * sizeof(uint64_t));
+  t->len = malloc((size_t) t->slots * sizeof(uint32_t));
+  t->out = malloc(t->slot_size + 1);
+  t->work = malloc(2 * (size_t) t->slot_size);
+  if (!t->hot || !t->packed || !t->pos || !t->len || !t->out || !t->work)
+    return -1;
+  return 0;
+}
+
+static int ts_tags_open(struct timeshift *t)
+{
+  t->tags = malloc((size_t) t->slots * sizeof(struct ts_tag));
+  return t->tags ? 0 : -1;
+}
+
+int ts_open(struct timeshift *t, uint32_t slot_size, int slots, const char *path, int frame)
+{
+  ts_init(t);
+  t->slot_size = slot_size;
+
+  if (!path && frame)
+  {
+    if (ts_pack_open(t, slots, frame) < 0)
+    {
+      ts_close(t);
+      return -1;
+    }
+    return ts_tags_open(t);
+  }
+  if (!path)
+  {
+    t->slots = t->hot_slots = slots;
+    t->hot = malloc((size_t) slots * slot_size);
+    return t->hot ? ts_tags_open(t) : -1;
+  }
+
+  t->chunk_slots = TS_CHUNK / (int) slot_size;
+  if (t->chunk_slots < 1)
+    return -1;
+  t->slots = (slots + t->chunk_slots - 1) / t->chunk_slots * t->chunk_slots;
+  t->hot_slots = TS_HOT / (int) slot_size;
+  if (t->hot_slots < 4)
+    t->hot_slots = 4;
+  if (t->hot_slots > t->slots)
+    t->hot_slots = t->slots;
+  t->hot = malloc((size_t) t->hot_slots * slot_size);
+  if (!t->hot || ts_spill_open(t, path) < 0)
+  {
+    ts_close(t);
+    return -1;
+  }
+  return ts_tags_open(t);
+}
+
+void ts_close(struct timeshift *t)
+{
+  ts_unmap(t, &t->w);
+#ifdef _WIN32
+  if (t->mapping)
+    CloseHandle((HANDLE) t->mapping);
+  if (t->file)
+    CloseHandle((HANDLE) t->file);
+  t->mapping = NULL;
+  t->file = NULL;
+#else
+  if (t->fd >= 0)
+    close(t->fd);
+#endif
+  t->fd = -1;
+  free(t->tags);
+  free(t->hot);
+  free(t->packed);
+  free(t->pos);
+  free(t->len);
+  free(t->out);
+  free(t->work);
+  ts_init(t);
+}
+
+char *ts_next(struct timeshift *t)
+{
+  return t->hot + (size_t) (t->written % (uint32_t) t->hot_slots) * t->slot_size;
+}
+
+/* slot n into the byte ring after the last one, or at its start if it
+ doesn't fit before the end. The slots it overwrites, and the one whose
+ index entry it takes, are dropped before it is written, readers check
+ oldest again once they have their copy */
+static void ts_pack_commit(struct timeshift *t, uint32_t n)
+{
+  uint32_t len = ts_pack(t, ts_next(t), (uint8_t *) t->out);
+  uint64_t at = t->packed_end;
+  uint64_t off = at % t->packed_size;
+  uint32_t o = t->oldest;
+
+  if (off + len > t->packed_size)
+    at += t->packed_size - off;
+  while (o != n && (n - o >= (uint32_t) t->slots ||
+         t->pos[o % (uint32_t) t->slots] + t->packed_size < at + len))
+    o++;
+  TS_STORE_REL(&t->oldest, o);
+  TS_FENCE_REL();
+  memcpy(t->packed + at % t->packed_size, t->out, len);
+  t->pos[n % (uint32_t) t->slots] = at;
+  t->len[n % (uint32_t) t->slots] = len;
+  t->packed_end = at + len;
+}
+
+/* the slot is also written through to the file, or packed, so it is
+ there once it falls out of RAM. returns -1 if the file can't be mapped,
+ the slot is still committed and stays readable while it is in RAM.
+ The tag goes in after the slots it replaces are dropped */
+int ts_commit(struct timeshift *t, const struct ts_tag *tag)
+{
+  uint32_t n = t->written;
+  char *dst;
+  int r = 0;
+
+  if (t->frame)
+    ts_pack_commit(t, n);
+  else if (t->chunk_slots)
+  {
+    dst = ts_spilled(t, &t->w, n % (uint32_t) t->slots);
+    if (dst)
+      memcpy(dst, ts_next(t), t->slot_size);
+    else
+      r = -1;
+  }
+  t->tags[n % (uint32_t) t->slots] = *tag;
+  TS_STORE_REL(&t->written, n + 1);
+  return r;
+}
+
+/* a reader unpacks the slot from its own copy, so a slot overwritten
+ while it is copied is noticed before it is decoded */
+static const char *ts_unpacked(struct timeshift *t, struct ts_reader *r, uint32_t n, uint32_t written)
+{
+  uint32_t o = TS_LOAD_ACQ(&t->oldest);
+  uint32_t k = n % (uint32_t) t->slots;
+  uint32_t len;
+  size_t copy;
+
+  if (r->pcm_ok && r->pcm_n == n)
+    return r->pcm;
+  if ((int32_t) (n - o) < 0 || (int32_t) (written - n) <= 0)
+    return NULL;
+  if (!r->pcm)
+  {
+    copy = (t->slot_size + 8) & ~(size_t) 7;
+    r->pcm = malloc(t->slot_size + copy + 2 * (size_t) t->slot_size);
+    if (!r->pcm)
+      return NULL;
+    r->copy = (uint8_t *) r->pcm + t->slot_size;
+    r->work = (int32_t *) (r->pcm + t->slot_size + copy);
+  }
+  r->pcm_ok = 0;
+  len = t->len[k];
+  if (len > t->slot_size + 1)
+    return NULL;
+  memcpy(r->copy, t->packed + t->pos[k] % t->packed_size, len);
+  TS_FENCE_ACQ();
+  o = TS_LOAD_ACQ(&t->oldest);
+  if ((int32_t) (n - o) < 0 || ts_unpack(t, r->copy, len, r->pcm, r->work) < 0)
+    return NULL;
+  r->pcm_n = n;
+  r->pcm_ok = 1;
+  return r->pcm;
+}
+
+const char *ts_slot(struct timeshift *t, struct ts_reader *r, uint32_t n)
+{
+  uint32_t written = TS_LOAD_ACQ(&t->written);
+  uint32_t age = written - n;
+
+  /* the writer is filling the hot slot of the next number */
+  if (age < (uint32_t) t->hot_slots)
+    return t->hot + (size_t) (n % (uint32_t) t->hot_slots) * t->slot_size;
+  if (t->frame)
+    return ts_unpacked(t, r, n, written);
+  /* all in RAM, it is gone */
+  if (!t->chunk_slots)
+    return NULL;
+  /* past the ts_depth newest its file slot holds a newer one */
+  if (age > (uint32_t) t->slots - 1)
+    return NULL;
+  return ts_spilled(t, r, n % (uint32_t) t->slots);
+}
+
+/* len bytes of the history from byte pos on, across slots. What is gone
+ reads as silence, returns how many bytes of it there were */
+uint32_t ts_read(struct timeshift *t, struct ts_reader *r, uint64_t pos, char *dst, uint32_t len)
+{
+  const char *src;
+  uint32_t off, n, gone = 0;
+
+  while (len > 0)
+  {
+    off = (uint32_t) (pos % t->slot_size);
+    n = t->slot_size - off;
+    if (n > len)
+      n = len;
+    src = ts_slot(t, r, (uint32_t) (pos / t->slot_size));
+    if (src)
+      memcpy(dst, src + off, n);
+    else
+    {
+      memset(dst, 0, n);
+      gone += n;
+    }
+    pos += n;
+    dst += n;
+    len -= n;
+  }
+  return gone;
+}
+
+uint32_t ts_depth(struct timeshift *t)
+{
+  uint32_t o = TS_LOAD_ACQ(&t->oldest);
+  uint32_t written = TS_LOAD_ACQ(&t->written);
+
+  /* oldest first, it never passes the written it was stored with */
+  if (t->frame)
+    return written - o;
+  return written < (uint32_t) t->slots ? written : (uint32_t) t->slots - 1;
+}
+
+/* slot n is one of the ts_depth newest */
+static int ts_has(struct timeshift *t, uint32_t n)
+{
+  uint32_t o = TS_LOAD_ACQ(&t->oldest);
+  uint32_t written = TS_LOAD_ACQ(&t->written);
+
+  if (!t->frame)
+    o = written < (uint32_t) t->slots ? 0 : written - (uint32_t) t->slots + 1;
+  return (int32_t) (n - o) >= 0 && (int32_t) (written - n) > 0;
+}
+
+/* checked again once it is copied, like a packed slot */
+int ts_tag(struct timeshift *t, uint32_t n, struct ts_tag *tag)
+{
+  if (!t->tags || !ts_has(t, n))
+    return -1;
+  *tag = t->tags[n % (uint32_t) t->slots];
+  TS_FENCE_ACQ();
+  return ts_has(t, n) ? 0 : -1;
+}
+
+/* the tags only go forward, the writer keeps them that way */
+int ts_find(struct timeshift *t, int64_t ms, uint32_t *n)
+{
+  uint32_t written = TS_LOAD_ACQ(&t->written);
+  uint32_t lo = written - ts_depth(t), hi = written, mid;
+  struct ts_tag tag;
+
+  /* the oldest ones may go while we look */
+  while (lo != hi && ts_tag(t, lo, &tag) < 0)
+    lo++;
+  if (lo == hi || tag.ms > ms)
+    return -1;
+  while (hi - lo > 1)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (ts_tag(t, mid, &tag) < 0 || tag.ms <= ms)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  *n = lo;
+  return 0;
+}
+
+uint32_t ts_freq_start(struct timeshift *t, uint32_t n)
+{
+  struct ts_tag tag, prev;
+
+  if (ts_tag(t, n, &tag) < 0)
+    return n;
+  while (ts_tag(t, n - 1, &prev) == 0 && prev.freq == tag.freq)
+    n--;
+  return n;
+}